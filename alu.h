@@ -0,0 +1,84 @@
+#ifndef ALU_H
+#define ALU_H
+
+#include <cstdint>
+
+// Arithmetic shared by the CPU's 8-bit ALU instructions, worked out without branches: carries come from
+// the bit above the result, and DAA from a table built at compile time. Kept apart from gb.cpp so that
+// tests/alubench.cpp can time it against the old branching helpers.
+
+// Adds two bytes and a carry. The sum is in the low byte of the result and the carry out in bit 8.
+constexpr uint16_t addBytes(uint8_t x, uint8_t y, uint8_t carryIn)
+{
+	return static_cast<uint16_t>(x + y + carryIn);
+}
+
+// Subtracts a byte and a borrow from another byte. The difference is in the low byte of the result and
+// the borrow out in bit 8.
+constexpr uint16_t subBytes(uint8_t x, uint8_t y, uint8_t borrowIn)
+{
+	return static_cast<uint16_t>((x - y - borrowIn) & 0x1FF);
+}
+
+// Checks if adding two values and a carry carries out of bit 3.
+constexpr bool halfCarryAdd(unsigned x, unsigned y, unsigned carryIn)
+{
+	return (x & 0xF) + (y & 0xF) + carryIn > 0xF;
+}
+
+// Checks if subtracting a value and a borrow from another borrows from bit 4.
+constexpr bool halfCarrySub(unsigned x, unsigned y, unsigned borrowIn)
+{
+	return (x & 0xF) < (y & 0xF) + borrowIn;
+}
+
+// Results of DAA for every value of A and the N, H and C flags, indexed by C << 10 | H << 9 | N << 8 | A.
+// Each entry holds the adjusted A in the low byte and the new carry flag in bit 8. Built at compile time.
+struct daaTable
+{
+	uint16_t entry[0x800];
+};
+
+constexpr daaTable makeDaaTable()
+{
+	daaTable table = {};
+	for (int i = 0; i < 0x800; i++)
+	{
+		int a = i & 0xFF;
+		int n = (i >> 8) & 0x1;
+		int h = (i >> 9) & 0x1;
+		int c = (i >> 10) & 0x1;
+
+		// After an addition, correct each digit that went past 9. After a subtraction, correct each digit
+		// that borrowed.
+		if (n == 0)
+		{
+			if (a > 0x99 || c == 1)
+			{
+				a = (a + 0x60) & 0xFF;
+				c = 1;
+			}
+			if ((a & 0xF) > 0x9 || h == 1)
+				a = (a + 0x6) & 0xFF;
+		}
+		else
+		{
+			if (c == 1)
+				a = (a - 0x60) & 0xFF;
+			if (h == 1)
+				a = (a - 0x6) & 0xFF;
+		}
+		table.entry[i] = static_cast<uint16_t>(a | (c << 8));
+	}
+	return table;
+}
+
+constexpr daaTable daaResults = makeDaaTable();
+
+// Adjusts A to binary-coded decimal after an addition or subtraction. The adjusted A is in the low byte
+// of the result and the new carry flag in bit 8.
+inline uint16_t daaResult(uint8_t a, bool n, bool h, bool c)
+{
+	return daaResults.entry[(c << 10) | (h << 9) | (n << 8) | a];
+}
+#endif // ALU_H
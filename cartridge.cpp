@@ -0,0 +1,598 @@
+#include "gb.h"
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Cartridges with more than 32KB of ROM, or with RAM, have a memory bank controller (MBC) that maps one
+// bank of each into the address space at a time: ROM at 4000-7FFF (and on MBC1 also 0000-3FFF) and RAM
+// at A000-BFFF. The game picks banks by writing to the ROM area. Those writes end up in writeMbc(), and
+// the memory map is pointed at the new banks in the ROM image and cartridge RAM without copying them.
+
+// A ROM image shared by every instance that has loaded the same file. Dumps are a power of two number
+// of banks, so the file can be mapped read-only and used as it is. Other sizes are copied into a buffer
+// padded with zeroes, as reading past the end of a mapped file would fault.
+struct sharedRom
+{
+	std::string path;
+	const uint8_t* data;
+	size_t size;															// Bytes at data, romBanks banks.
+	int banks;
+	int users;																// Instances using the image.
+	bool mapped;															// Set if data is a view of the file rather than a copy.
+};
+
+// The images loaded so far, by path. Instances can be global, like the frontend's, and close their ROM
+// from their destructor, after any static object in this file may already have been destroyed. So the
+// table is created on first use and never freed.
+struct sharedRomTable
+{
+	std::map<std::string, sharedRom*> roms;
+	std::mutex lock;														// Guards roms and every image's users.
+};
+
+static sharedRomTable& sharedRoms()
+{
+	static sharedRomTable* table = new sharedRomTable;
+	return *table;
+}
+
+// An empty 32KB cartridge, run until a game is loaded.
+static const uint8_t blankRom[0x8000] = {};
+
+// Maps the first size bytes of a file read-only. Returns null if it can't.
+static const uint8_t* mapFile(const char* filename, size_t size)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size) : NULL;
+
+	// The view keeps the file open.
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+	return static_cast<const uint8_t*>(view);
+#else
+	int file = open(filename, O_RDONLY);
+	if (file < 0)
+		return nullptr;
+	void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+	return view == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(view);
+#endif
+}
+
+static void unmapFile(const uint8_t* data, size_t size)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(const_cast<uint8_t*>(data), size);
+#endif
+}
+
+// Points rom at the image of a ROM file, loading it unless another instance already has. Returns false
+// if the file can't be read.
+bool gb::openRom(const char* filename)
+{
+	sharedRomTable& shared = sharedRoms();
+	std::lock_guard<std::mutex> lock(shared.lock);
+	auto found = shared.roms.find(filename);
+	if (found != shared.roms.end())
+	{
+		romFile = found->second;
+		romFile->users += 1;
+	}
+	else
+	{
+		std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return false;
+		std::streamoff fileSize = file.tellg();
+		std::cout << "ROM size: " << fileSize << '\n';
+
+		// Pad the image to a power of two number of banks (at least two), so bank numbers can be masked.
+		// An MBC5 can address at most 512.
+		int banks = 2;
+		while (banks * 0x4000 < fileSize && banks < 512)
+			banks *= 2;
+		size_t size = banks * 0x4000;
+		const uint8_t* data = nullptr;
+		bool mapped = fileSize >= std::streamoff(size);
+		if (mapped)
+			data = mapFile(filename, size);
+		if (!data)
+		{
+			uint8_t* copy = new uint8_t[size]();
+			file.seekg(0, std::ios::beg);
+			file.read(reinterpret_cast<char*>(copy), fileSize < std::streamoff(size) ? fileSize : size);
+			data = copy;
+			mapped = false;
+		}
+
+		romFile = new sharedRom{ filename, data, size, banks, 1, mapped };
+		shared.roms[filename] = romFile;
+	}
+
+	rom = romFile->data;
+	romBanks = romFile->banks;
+	return true;
+}
+
+// Stops using the ROM image, freeing it if no other instance is.
+void gb::closeRom()
+{
+	rom = nullptr;
+	if (!romFile)
+		return;
+
+	sharedRomTable& shared = sharedRoms();
+	std::lock_guard<std::mutex> lock(shared.lock);
+	romFile->users -= 1;
+	if (romFile->users == 0)
+	{
+		shared.roms.erase(romFile->path);
+		if (romFile->mapped)
+			unmapFile(romFile->data, romFile->size);
+		else
+			delete[] romFile->data;
+		delete romFile;
+	}
+	romFile = nullptr;
+}
+
+// Loads the empty cartridge.
+void gb::openBlankRom()
+{
+	rom = blankRom;
+	romBanks = 2;
+}
+
+// Battery-backed cartridge RAM is kept in a .sav file next to the ROM, mapped into memory so the game's
+// writes go straight to the file's pages and the OS writes them back in the background. The file holds
+// the RAM banks in order, followed on MBC3 cartridges with a clock by rtcSaveSize bytes of clock state:
+// the five clock registers and their latched copies as 32-bit values, then the host time they were
+// saved at in seconds as a 64-bit value, all little-endian. Other emulators use the same layout.
+constexpr size_t rtcSaveSize = 48;
+constexpr uint64_t secondsPerDay = 24 * 60 * 60;
+
+// The save files mapped so far, by path. An instance that opened a save another one has mapped would
+// see its RAM change under it, so it is given RAM of its own instead. Created on first use and never
+// freed, like sharedRoms().
+struct mappedSave
+{
+	std::string path;
+};
+
+struct mappedSaveTable
+{
+	std::map<std::string, mappedSave*> saves;
+	std::mutex lock;
+};
+
+static mappedSaveTable& mappedSaves()
+{
+	static mappedSaveTable* table = new mappedSaveTable;
+	return *table;
+}
+
+// Maps a save file read-write, creating it or extending it with zeroes if it is shorter than size.
+// Returns null if it can't.
+static uint8_t* mapSaveFile(const char* filename, size_t size)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, DWORD(size), NULL);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : NULL;
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+	return static_cast<uint8_t*>(view);
+#else
+	int file = open(filename, O_RDWR | O_CREAT, 0644);
+	if (file < 0)
+		return nullptr;
+	struct stat info;
+	void* view = MAP_FAILED;
+	if (fstat(file, &info) == 0 && (size_t(info.st_size) >= size || ftruncate(file, size) == 0))
+		view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	close(file);
+	return view == MAP_FAILED ? nullptr : static_cast<uint8_t*>(view);
+#endif
+}
+
+// Starts writing battery-backed RAM back to the save file. With wait set, returns once it has been
+// written.
+void gb::flushSave(bool wait)
+{
+	framesSinceSave = 0;
+	if (!saveData)
+		return;
+	if (rtcSaveData)
+		storeRtc();
+#ifdef _WIN32
+	FlushViewOfFile(saveData, saveSize);
+#else
+	msync(saveData, saveSize, wait ? MS_SYNC : MS_ASYNC);
+#endif
+}
+
+// Works out the MBC and the amount of cartridge RAM from the cartridge header, and sets up a new
+// cartridge with its banks in their initial state. rom and romBanks must already hold the ROM image.
+// If the cartridge has a battery, its RAM is mapped from the save file for the ROM at filename.
+void gb::setUpCartridge(const char* filename)
+{
+	bool battery = false;
+	bool clock = false;
+	switch (rom[0x147])
+	{
+	case 0x00: case 0x08:
+		mbc = MBC_NONE;
+		break;
+	case 0x09:
+		mbc = MBC_NONE;
+		battery = true;
+		break;
+	case 0x01: case 0x02:
+		mbc = MBC1;
+		break;
+	case 0x03:
+		mbc = MBC1;
+		battery = true;
+		break;
+	case 0x11: case 0x12:
+		mbc = MBC3;
+		break;
+	case 0x0F: case 0x10:
+		mbc = MBC3;
+		battery = true;
+		clock = true;
+		break;
+	case 0x13:
+		mbc = MBC3;
+		battery = true;
+		break;
+	case 0x19: case 0x1A: case 0x1C: case 0x1D:
+		mbc = MBC5;
+		break;
+	case 0x1B: case 0x1E:
+		mbc = MBC5;
+		battery = true;
+		break;
+	default:
+		printf("Unsupported cartridge type %X, running it without an MBC.\n", rom[0x147]);
+		mbc = MBC_NONE;
+		break;
+	}
+
+	// Cartridge RAM size, in 8KB banks. 2KB of RAM is given a whole bank.
+	static const int ramBanksForSize[6] = { 0, 1, 1, 4, 16, 8 };
+	releaseCartRam();
+	cartRamBanks = rom[0x149] < 6 ? ramBanksForSize[rom[0x149]] : 0;
+	size_t ramSize = cartRamBanks * 0x2000;
+	if (battery && saveBattery && filename && (ramSize > 0 || clock))
+	{
+		// Name the save after the ROM, swapping its extension for .sav.
+		std::string path = filename;
+		size_t dot = path.find_last_of("./\\");
+		if (dot != std::string::npos && path[dot] == '.')
+			path.erase(dot);
+		path += ".sav";
+
+		// Another instance running the same game has the save mapped, so start from a copy of it.
+		mappedSaveTable& mapped = mappedSaves();
+		std::lock_guard<std::mutex> lock(mapped.lock);
+		if (mapped.saves.count(path))
+		{
+			printf("Save file %s is already in use by another instance, so this one's progress won't be saved.\n", path.c_str());
+			if (ramSize > 0)
+			{
+				cartRam = new uint8_t[ramSize]();
+				std::ifstream(path, std::ios::in | std::ios::binary).read(reinterpret_cast<char*>(cartRam), ramSize);
+			}
+		}
+		else
+		{
+			saveSize = ramSize + (clock ? rtcSaveSize : 0);
+			saveData = mapSaveFile(path.c_str(), saveSize);
+			if (saveData)
+			{
+				cartRam = ramSize > 0 ? saveData : nullptr;
+				saveFile = new mappedSave{ path };
+				mapped.saves[path] = saveFile;
+			}
+			else
+				printf("Unable to open save file %s, progress won't be saved.\n", path.c_str());
+		}
+	}
+	if (ramSize > 0 && !cartRam)
+		cartRam = new uint8_t[ramSize]();
+
+	// The clock starts at zero unless the save file has its state.
+	hasRtc = clock;
+	rtcSaveData = saveData && clock ? saveData + ramSize : nullptr;
+	rtcSeconds = 0;
+	rtcUpdatedAt = rtcClock();
+	rtcHalted = false;
+	rtcCarry = false;
+	memset(rtcLatched, 0, sizeof(rtcLatched));
+	if (rtcSaveData)
+		loadRtc();
+
+	memset(unmappedPage, 0xFF, sizeof(unmappedPage));
+	clearDecodedRom();
+	resetMbc();
+}
+
+// Puts the MBC back in the state it starts in, with bank 1 at 4000-7FFF and RAM disabled.
+void gb::resetMbc()
+{
+	cartRamEnabled = mbc == MBC_NONE;
+	romBankRegister = 1;
+	ramBankRegister = 0;
+	mbc1Mode = false;
+	rtcLatchWrite = 0xFF;
+	romWindowBank[0] = -1;
+	romWindowBank[1] = -1;
+	cartRamWindow = nullptr;
+	rtcRegister = -1;
+	updateBanks();
+}
+
+// Handles a write to the MBC's registers in the ROM area.
+void gb::writeMbc(uint16_t addr, uint8_t data)
+{
+	switch (mbc)
+	{
+	case MBC1:
+		if (addr < 0x2000)
+			cartRamEnabled = (data & 0xF) == 0xA;
+		else if (addr < 0x4000)
+			romBankRegister = data & 0x1F;
+		else if (addr < 0x6000)
+			ramBankRegister = data & 0x3;
+		else
+			mbc1Mode = data & 0x1;
+		break;
+
+	case MBC3:
+		if (addr < 0x2000)
+			cartRamEnabled = (data & 0xF) == 0xA;
+		else if (addr < 0x4000)
+			romBankRegister = data & 0x7F;
+		else if (addr < 0x6000)
+			ramBankRegister = data & 0xF;									// 0-3 select RAM banks, 8-C the clock registers.
+		else if (hasRtc)
+		{
+																			// Writing 0 then 1 latches the clock.
+			if (rtcLatchWrite == 0 && data == 1)
+				latchRtc();
+			rtcLatchWrite = data;
+			return;
+		}
+		break;
+
+	case MBC5:
+		if (addr < 0x2000)
+			cartRamEnabled = (data & 0xF) == 0xA;
+		else if (addr < 0x3000)
+			romBankRegister = (romBankRegister & 0x100) | data;
+		else if (addr < 0x4000)
+			romBankRegister = (romBankRegister & 0xFF) | ((data & 0x1) << 8);
+		else if (addr < 0x6000)
+			ramBankRegister = data & 0xF;
+		break;
+
+	default:
+		return;
+	}
+	updateBanks();
+}
+
+// Works out which banks the MBC's registers select and remaps the pages of any window that changed.
+// A ROM window is 64 page pointers and the RAM window 32.
+void gb::updateBanks()
+{
+	int low = 0;
+	int high = 1;
+	int ramBank = ramBankRegister;
+	switch (mbc)
+	{
+	case MBC1:	// Bank 0 can't be selected at 4000-7FFF, so 00, 20, 40 and 60 select the bank after.
+		high = (ramBankRegister << 5) | (romBankRegister == 0 ? 1 : romBankRegister);
+		low = mbc1Mode ? ramBankRegister << 5 : 0;
+		ramBank = mbc1Mode ? ramBankRegister : 0;
+		break;
+	case MBC3:
+		high = romBankRegister == 0 ? 1 : romBankRegister;
+		break;
+	case MBC5:
+		high = romBankRegister;
+		break;
+	default:
+		ramBank = 0;
+		break;
+	}
+
+	const int banks[2] = { low & (romBanks - 1), high & (romBanks - 1) };
+	for (int window = 0; window < 2; window++)
+	{
+		if (banks[window] != romWindowBank[window])
+		{
+			romWindowBank[window] = banks[window];
+			decodedWindow[window] = decodedBanks[banks[window]];
+			for (int page = window * 0x40; page < window * 0x40 + 0x40; page++)
+				mapPage(page);
+		}
+	}
+
+	// MBC5 has up to 16 RAM banks, but MBC1 and MBC3 only 4. MBC3 maps its clock registers in place of
+	// banks 8-C. Every page then reads from rtcPage, which is filled with the latched value of the
+	// selected register.
+	uint8_t* ram = nullptr;
+	if (cartRamEnabled && cartRam && (mbc == MBC5 || ramBank < 4))
+		ram = cartRam + (ramBank & (cartRamBanks - 1)) * 0x2000;
+	int clockRegister = -1;
+	if (cartRamEnabled && hasRtc && ramBank >= 8 && ramBank <= 0xC)
+		clockRegister = ramBank - 8;
+	if (ram != cartRamWindow || clockRegister != rtcRegister)
+	{
+		cartRamWindow = ram;
+		rtcRegister = clockRegister;
+		if (rtcRegister >= 0)
+			memset(rtcPage, rtcLatched[rtcRegister], sizeof(rtcPage));
+		for (int page = 0xA0; page < 0xC0; page++)
+			mapPage(page);
+	}
+}
+
+// The MBC3 clock counts seconds, minutes, hours and a 9-bit day counter, which sets a carry bit when it
+// overflows. Rather than ticking it, the time is kept as a number of seconds and brought up to date
+// from rtcClock() when the game latches or sets it. The game reads the registers as last latched.
+
+// Returns the time the clock runs from, in seconds: the host's clock, or the cycle counter at 2^20
+// machine cycles a second, so that runs with rtcHostTime off are repeatable.
+uint64_t gb::rtcClock()
+{
+	return rtcHostTime ? static_cast<uint64_t>(time(nullptr)) : counter >> 20;
+}
+
+// Adds the seconds passed since the clock was last brought up to date, unless it is halted.
+void gb::updateRtc()
+{
+	uint64_t now = rtcClock();
+	if (!rtcHalted && now > rtcUpdatedAt)
+		rtcSeconds += now - rtcUpdatedAt;
+	rtcUpdatedAt = now;
+	if (rtcSeconds >= 512 * secondsPerDay)
+	{
+		rtcSeconds %= 512 * secondsPerDay;
+		rtcCarry = true;
+	}
+}
+
+// Works out the five clock registers from the time: seconds, minutes, hours, the low 8 bits of the day
+// and the day's top bit with the halt and carry flags.
+void gb::getRtcRegisters(uint8_t registers[5])
+{
+	uint64_t days = rtcSeconds / secondsPerDay;
+	registers[0] = rtcSeconds % 60;
+	registers[1] = rtcSeconds / 60 % 60;
+	registers[2] = rtcSeconds / 3600 % 24;
+	registers[3] = days & 0xFF;
+	registers[4] = ((days >> 8) & 0x1) | (rtcHalted ? 0x40 : 0) | (rtcCarry ? 0x80 : 0);
+}
+
+// Copies the current time into the registers the game reads.
+void gb::latchRtc()
+{
+	updateRtc();
+	getRtcRegisters(rtcLatched);
+	if (rtcRegister >= 0)
+		memset(rtcPage, rtcLatched[rtcRegister], sizeof(rtcPage));
+}
+
+// Sets one of the clock registers, which also shows in its latched copy.
+void gb::writeRtc(int reg, uint8_t data)
+{
+	static const uint8_t masks[5] = { 0x3F, 0x3F, 0x1F, 0xFF, 0xC1 };
+	updateRtc();
+	uint8_t registers[5];
+	getRtcRegisters(registers);
+	registers[reg] = data & masks[reg];
+	rtcHalted = (registers[4] >> 6) & 0x1;
+	rtcCarry = (registers[4] >> 7) & 0x1;
+	rtcSeconds = registers[0] + registers[1] * 60 + registers[2] * 3600 +
+		(registers[3] | (registers[4] & 0x1) << 8) * secondsPerDay;
+	rtcLatched[reg] = registers[reg];
+	memset(rtcPage, rtcLatched[reg], sizeof(rtcPage));
+}
+
+// Reads the clock from the save file. With rtcHostTime set, the time the host spent off counts too, as
+// it would for the real cartridge's battery.
+void gb::loadRtc()
+{
+	uint8_t registers[5];
+	for (int i = 0; i < 5; i++)
+	{
+		registers[i] = rtcSaveData[i * 4];
+		rtcLatched[i] = rtcSaveData[20 + i * 4];
+	}
+	uint64_t savedAt = 0;
+	for (int i = 7; i >= 0; i--)
+		savedAt = (savedAt << 8) | rtcSaveData[40 + i];
+
+	rtcHalted = (registers[4] >> 6) & 0x1;
+	rtcCarry = (registers[4] >> 7) & 0x1;
+	rtcSeconds = registers[0] + registers[1] * 60 + registers[2] * 3600 +
+		(registers[3] | (registers[4] & 0x1) << 8) * secondsPerDay;
+	if (rtcHostTime && savedAt != 0)
+		rtcUpdatedAt = savedAt;
+	updateRtc();
+}
+
+// Writes the clock into the save file.
+void gb::storeRtc()
+{
+	updateRtc();
+	uint8_t registers[5];
+	getRtcRegisters(registers);
+	memset(rtcSaveData, 0, rtcSaveSize);
+	for (int i = 0; i < 5; i++)
+	{
+		rtcSaveData[i * 4] = registers[i];
+		rtcSaveData[20 + i * 4] = rtcLatched[i];
+	}
+	uint64_t savedAt = static_cast<uint64_t>(time(nullptr));
+	for (int i = 0; i < 8; i++)
+		rtcSaveData[40 + i] = (savedAt >> (i * 8)) & 0xFF;
+}
+
+// Frees the cartridge RAM, writing it back first if it is mapped from a save file.
+void gb::releaseCartRam()
+{
+	if (saveData)
+	{
+		flushSave(true);
+#ifdef _WIN32
+		UnmapViewOfFile(saveData);
+#else
+		munmap(saveData, saveSize);
+#endif
+		saveData = nullptr;
+		rtcSaveData = nullptr;
+
+		mappedSaveTable& mapped = mappedSaves();
+		std::lock_guard<std::mutex> lock(mapped.lock);
+		mapped.saves.erase(saveFile->path);
+		delete saveFile;
+		saveFile = nullptr;
+	}
+	else
+		delete[] cartRam;
+	cartRam = nullptr;
+}
+
+// Frees the cartridge RAM and everything decoded from the ROM, and lets go of the ROM image.
+void gb::releaseCartridge()
+{
+	clearDecodedRom();
+	closeRom();
+	releaseCartRam();
+}
@@ -1,6 +1,10 @@
 #include "gb.h"
+#include "alu.h"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <vector>
 
 // Initialize the Game Boy by setting the register values.
 void gb::initialize()
@@ -9,13 +13,32 @@ void gb::initialize()
 	if (logging)
 	{
 		remove("output.txt");
+#ifdef _MSC_VER
 		fopen_s(&pFile, "output.txt", "a");
+#else
+		pFile = fopen("output.txt", "a");
+#endif
 	}
 
 	// Sets all memory locations to zero.
 	for (int i = 0x0000; i <= 0xFFFF; i++) 
 		memory[i] = 0x0;
 
+	// Until a game is loaded, run an empty 32KB cartridge. Otherwise put the MBC back in its initial state.
+	if (!rom)
+	{
+		openBlankRom();
+		setUpCartridge(nullptr);
+	}
+	else
+		resetMbc();
+	dmaActive = false;
+	mapMemory();
+
+	// Throw away any code compiled for a previous game.
+	if (jitBlocks)
+		flushJit();
+
 	// Set values of CPU registers.
 	A = 0x01;
 	F = 0xB0;
@@ -28,14 +51,18 @@ void gb::initialize()
 	SP = 0xFFFE;
 
 	// Set initial values of flag bits.
-	Zb = 1;
-	Nb = 0;
-	Hb = 1;
-	Cb = 1;
-
-	// Set values for the counter, I/O registers and program counter.
-	counter = 0xABBC;
-	memory[0xFF04] = counter >> 8;
+	setF(F);
+
+	// Set values for the counter, I/O registers and program counter. The counter starts where the
+	// boot ROM leaves it, so that DIV reads 0xAB. The cartridge clock is brought up to date first, and
+	// then runs on from the new counter, as it may be counting machine cycles rather than host time.
+	if (hasRtc)
+		updateRtc();
+	counter = 0x2AEF;
+	rtcUpdatedAt = rtcClock();
+	divReset = 0;
+	timaUpdatedAt = counter;
+	joypad = 0;
 	memory[0xFF05] = 0x00;
 	memory[0xFF06] = 0x00;
 	memory[0xFF07] = 0x00;
@@ -68,3480 +95,3611 @@ void gb::initialize()
 	memory[0xFF4B] = 0x00;
 	memory[0xFFFF] = 0x00;
 	PC = 0x100;
+	halted = false;
+	haltBug = false;
+	idleLoop.valid = false;
+	serialDone = false;
+	IME = false;
+	updateInterrupts();
+
+	// Start the scheduler with the LCD at the start of line 0.
+	eventCount = 0;
+	nextEventAt = UINT64_MAX;
+	for (int i = 0; i < EVENT_COUNT; i++)
+		eventHeapPos[i] = -1;
+	startLine(counter);
 }
 
-// Load a ROM and set the game's name.
+// Load a ROM and set the game's name. The ROM image is mapped from the file and shared with any other
+// instance running the same game, see openRom().
 void gb::loadGame(char filename[], char* gameTitle)
 {
-	std::streampos size;
-	char* memblock;
-	std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-	if (file.is_open())
-	{
-		size = file.tellg();
-		std::cout << "ROM size: " << size << '\n';
-		memblock = new char[unsigned int (size) + 1]; // Add 1 to hold escape code.
-		file.seekg(0, std::ios::beg);
-		file.read(memblock, size);
-		file.close();
+	releaseCartridge();
+	if (openRom(filename))
 		printf("ROM loaded.\n");
-		for (int i = 0; i < size; i++)
-			memory[i] = memblock[i];
-		delete[] memblock;
-	}
-	else 
+	else
+	{
 		printf("Unable to load ROM.\n");
+		openBlankRom();
+	}
+	setUpCartridge(filename);
+	mapMemory();
+	if (jitBlocks)
+		flushJit();
 
 	// Set the game's name using information from the cartridge header.
 	int offset = 0;
 	for (uint16_t i = 0x134; i < 0x144; i++)
 	{
-		*(gameTitle + offset) = memory[i];
+		*(gameTitle + offset) = rom[i];
 		offset += 1;
 	}
 }
 
-// Emulate a cycle of the Game Boy CPU.
-void gb::emulateCycle()
+// Returns the decoded instruction at an address in ROM, decoding the bank there if no code in it has
+// run before. Returns null for the last two bytes of a bank, where an instruction's operands could be
+// in a different bank, as those have to be decoded as they run.
+const gb::decodedInstruction* gb::findDecodedInstruction(uint16_t addr)
 {
-	// If scheduled to set the IME, check if it should occur on this cycle. If it should, set it, otherwise do it next cycle.
-	if (scheduleIME)
-	{
-		if (cyclesBeforeEnableIME == 1)
-			cyclesBeforeEnableIME = 0;
-		else
-		{
-			EI();
-		}
-	}
+	int window = addr >> 14;
+	if (!decodedWindow[window])
+		decodeBank(window);
+	const decodedInstruction& inst = decodedWindow[window][addr & 0x3FFF];
+	return inst.handler ? &inst : nullptr;
+}
 
-	// Handle interrupts
-	if (IME)
+// Decodes every instruction in the ROM bank mapped at a window (0000-3FFF or 4000-7FFF) for the cached
+// interpreter.
+void gb::decodeBank(int window)
+{
+	int bank = romWindowBank[window];
+	const uint8_t* code = rom + bank * 0x4000;
+	decodedInstruction* decoded = new decodedInstruction[0x4000]();
+	for (int addr = 0; addr < 0x3FFE; addr++)
 	{
-		for (int i = 0; i < 5; i++)
+		uint8_t op = code[addr];
+		decoded[addr].handler = opTable[op];
+		decoded[addr].imm16 = (code[addr + 2] << 8) | code[addr + 1];
+		decoded[addr].cycles = opCycles[op];
+
+		// Run a common pair as one. Both instructions have at most one operand byte, which go in imm8 and
+		// immHigh.
+		int next = addr + opLengths[op];
+		if (next >= 0x3FFF)
+			continue;
+		uint8_t nextOp = code[next];
+		for (const fusedPair& pair : fusedPairs)
 		{
-			if (((memory[IF] >> i) & 0x1) == 1)
+			if (pair.first == op && pair.second == nextOp)
 			{
-				if (((memory[IE] >> i) & 0x1) == 1)
-				{
-
-					modifyBit(memory[IF], 0, i);
-					DI();
-					writeToMemory(SP - 1, PC >> 8);
-					writeToMemory(SP - 2, PC & 0xFF);
-					SP -= 2;
-					PC = intVectors[i];
-					if (logging)
-						fprintf(pFile, "INTERRUPT %u\n", i);
-					break;
-				}
+				decoded[addr].handler = pair.handler;
+				decoded[addr].imm16 = (code[next + 1] << 8) | code[addr + 1];
+				break;
 			}
 		}
 	}
 
-	opcode = memory[PC];	// Get the current opcode.
-	char opcodeStr[3];		// Can store the opcode in a string so it can be printed.
-
-	if (opcode == 0xCB)		// Some instructions are prefixed with CB.
+	decodedBanks[bank] = decoded;
+	for (int i = 0; i < 2; i++)
 	{
+		if (romWindowBank[i] == bank)
+			decodedWindow[i] = decoded;
+	}
+}
 
-		// Print the current opcode and other info to the output log if logging.
-
-		if (logging)
-		{
-			_itoa_s(opcode, opcodeStr, 16);
-			fprintf(pFile,
-				"A: %02X F: %02X B: %02X C: %02X D: %02X E: %02X H: %02X L: %02X SP: %04X PC: 00:%04X (%s %X %X %X)\n",
-				A, F, B, C, D, E, H, L, SP, PC, opcodeStr, memory[PC + 1], memory[PC + 2], memory[PC + 3]);
-		}
-		
-		PC += 1;
-		opcode = memory[PC];
-		
-		// Check each half of the opcode to get to the required instruction.
-		switch (opcode & 0xF0)
-		{
-		case 0x00:	// Rotations without carry.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // RLC B
-				ROT('L', false, B);
-				PC += 1;
-				break;
-			
-			case 0x01: // RLC C
-				ROT('L', false, C);
-				PC += 1;
-				break;
-
-			case 0x02: // RLC D
-				ROT('L', false, D);
-				PC += 1;
-				break;
+// Throws away every decoded bank.
+void gb::clearDecodedRom()
+{
+	for (int i = 0; i < 512; i++)
+	{
+		delete[] decodedBanks[i];
+		decodedBanks[i] = nullptr;
+	}
+	decodedWindow[0] = nullptr;
+	decodedWindow[1] = nullptr;
+}
 
-			case 0x03: // RLC E
-				ROT('L', false, E);
-				PC += 1;
-				break;
+// Runs two instructions as one, for the cached interpreter. Calling both handlers directly lets the
+// compiler inline them into one function and keep values in registers across the pair. The second
+// instruction is left for the next step if anything has to happen between the two: an event falling
+// due, IME being enabled, or a breakpoint. The first instruction must not write to memory, so that it
+// can't request an interrupt or change the second. The counter is moved on past the first instruction
+// while the second runs, so that any I/O it does happens at the same cycle as it would unfused.
+template <gb::opHandler first, gb::opHandler second>
+void gb::fusedOp()
+{
+	(this->*first)();
+	if (counter + cycles >= nextEventAt || scheduleIME || breakpointCount > 0)
+		return;
 
-			case 0x04: // RLC H
-				ROT('L', false, H);
-				PC += 1;
-				break;
+	int firstCycles = cycles;
+	counter += firstCycles;
+	cycles = opCycles[readMemory(PC)];
+	imm8 = immHigh;
+	(this->*second)();
+	counter -= firstCycles;
+	cycles += firstCycles;
+}
 
-			case 0x05: // RLC L
-				ROT('L', false, L);
-				PC += 1;
-				break;
+// The pairs that decodeBank() fuses: reading an I/O register and comparing it (e.g. waiting for LY),
+// counting down a loop, and copying memory. Building with GB_PROFILE_PAIRS shows which pairs a game
+// runs most.
+const gb::fusedPair gb::fusedPairs[9] =
+{
+	{ 0xF0, 0xFE, &gb::fusedOp<&gb::opF0, &gb::opFE> },		// LDH A, (a8); CP d8
+	{ 0x05, 0x20, &gb::fusedOp<&gb::op05, &gb::op20> },		// DEC B; JR NZ, r8
+	{ 0x0D, 0x20, &gb::fusedOp<&gb::op0D, &gb::op20> },		// DEC C; JR NZ, r8
+	{ 0x15, 0x20, &gb::fusedOp<&gb::op15, &gb::op20> },		// DEC D; JR NZ, r8
+	{ 0x1D, 0x20, &gb::fusedOp<&gb::op1D, &gb::op20> },		// DEC E; JR NZ, r8
+	{ 0x25, 0x20, &gb::fusedOp<&gb::op25, &gb::op20> },		// DEC H; JR NZ, r8
+	{ 0x2D, 0x20, &gb::fusedOp<&gb::op2D, &gb::op20> },		// DEC L; JR NZ, r8
+	{ 0x3D, 0x20, &gb::fusedOp<&gb::op3D, &gb::op20> },		// DEC A; JR NZ, r8
+	{ 0x2A, 0x12, &gb::fusedOp<&gb::op2A, &gb::op12> },		// LD A, (HL+); LD (DE), A
+};
+
+#ifdef GB_PROFILE_PAIRS
+// Prints the pairs of instructions run most often by the interpreter.
+void gb::printPairProfile(int count)
+{
+	uint64_t total = 0;
+	std::vector<int> pairs;
+	for (int i = 0; i < 0x10000; i++)
+	{
+		total += pairCounts[i];
+		if (pairCounts[i] > 0)
+			pairs.push_back(i);
+	}
+	std::sort(pairs.begin(), pairs.end(), [this](int x, int y) { return pairCounts[x] > pairCounts[y]; });
 
-			case 0x06: // RLC (HL)
-				ROT('L', false, memory[H << 8 | L]);
-				PC += 1;
-				break;
+	for (int i = 0; i < count && i < static_cast<int>(pairs.size()); i++)
+	{
+		int pair = pairs[i];
+		printf("%02X %02X: %u (%.2f%%)\n", pair >> 8, pair & 0xFF, pairCounts[pair], 100.0 * pairCounts[pair] / total);
+	}
+}
+#endif
 
-			case 0x07: // RLC A
-				ROT('L', false, A);
-				PC += 1;
-				break;
+// Free the memory used by the cartridge and the JIT.
+gb::~gb()
+{
+	releaseCartridge();
+	releaseJit();
+}
 
-			case 0x08: // RRC B
-				ROT('R', false, B);
-				PC += 1;
-				break;
+// Emulate one instruction of the Game Boy CPU, returning the number of machine cycles it took. Builds
+// with GB_NO_TRACE defined leave tracing out entirely; otherwise the logging flag picks the traced
+// version of the instruction loop.
+int gb::emulateCycle()
+{
+#ifdef GB_NO_TRACE
+	return runInstruction<false>();
+#else
+	return logging ? runInstruction<true>() : runInstruction<false>();
+#endif
+}
 
-			case 0x09: // RRC C
-				ROT('R', false, C);
-				PC += 1;
-				break;
+// Runs instructions until one of the conditions in stopAt (a combination of stopReasons) is met, or
+// until at least maxCycles machine cycles have passed, and returns the reason. STOP_FRAME and
+// STOP_LINE stop when frameReady or lineReady is set, and clear it. STOP_BREAKPOINT stops before the
+// instruction at an address set with setBreakpoint(), other than the one run first. STOP_HALT stops
+// when HALT waits with IME off, as test ROMs do when they finish. STOP_SERIAL stops once a byte has
+// been sent through the serial port, which is left in serialByte. STOP_WATCHPOINT stops after an
+// instruction writes to an address set with setWatchpoint(), which is left in watchAddress.
+gb::stopReason gb::runUntil(int stopAt, uint64_t maxCycles)
+{
+	const bool stopFrame = (stopAt & STOP_FRAME) != 0;
+	const bool stopLine = (stopAt & STOP_LINE) != 0;
+	const bool stopBreakpoint = (stopAt & STOP_BREAKPOINT) != 0 && breakpointCount > 0;
+	const bool stopHalt = (stopAt & STOP_HALT) != 0;
+	const bool stopSerial = (stopAt & STOP_SERIAL) != 0;
+	const bool stopWatchpoint = (stopAt & STOP_WATCHPOINT) != 0 && watchpointCount > 0;
+	uint64_t end = counter + maxCycles;
+	serialDone = false;
+	watchHit = false;
+
+	while (counter < end)
+	{
+#ifdef GB_THREADED
+		if (backend == INTERPRETER && !stopBreakpoint && !stopWatchpoint)
+		{
+#ifdef GB_NO_TRACE
+			runThreaded<false>(end);
+#else
+			if (logging)
+				runThreaded<true>(end);
+			else
+				runThreaded<false>(end);
+#endif
+		}
+		else
+#endif
+			emulateCycle();
 
-			case 0x0A: // RRC D
-				ROT('R', false, D);
-				PC += 1;
-				break;
+		if (stopFrame && frameReady)
+		{
+			frameReady = false;
+			return STOP_FRAME;
+		}
+		if (stopLine && lineReady)
+		{
+			lineReady = false;
+			return STOP_LINE;
+		}
+		if (stopBreakpoint && ((breakpointBits[PC >> 3] >> (PC & 0x7)) & 0x1))
+			return STOP_BREAKPOINT;
+		if (stopHalt && halted && !IME)
+			return STOP_HALT;
+		if (stopSerial && serialDone)
+			return STOP_SERIAL;
+		if (stopWatchpoint && watchHit)
+			return STOP_WATCHPOINT;
+	}
+	return STOP_CYCLES;
+}
 
-			case 0x0B: // RRC E
-				ROT('R', false, E);
-				PC += 1;
-				break;
+// Runs for at least n machine cycles, stopping early at a breakpoint or watchpoint.
+gb::stopReason gb::runCycles(uint64_t n)
+{
+	return runUntil(STOP_BREAKPOINT | STOP_WATCHPOINT, n);
+}
 
-			case 0x0C: // RRC H
-				ROT('R', false, H);
-				PC += 1;
-				break;
+// Runs until the PPU finishes a frame, or a breakpoint or watchpoint is reached. With the LCD off no
+// frame is ever finished, so this also returns after a frame's worth of cycles.
+gb::stopReason gb::runFrame()
+{
+	return runUntil(STOP_FRAME | STOP_BREAKPOINT | STOP_WATCHPOINT, 17556);
+}
 
-			case 0x0D: // RRC L
-				ROT('R', false, L);
-				PC += 1;
-				break;
+// Sets or clears a breakpoint for runUntil(). Compiled blocks run several instructions at a time, and
+// idle loop skipping runs whole loops at once, so neither is used while any breakpoints are set.
+void gb::setBreakpoint(uint16_t addr, bool set)
+{
+	uint8_t bit = 1 << (addr & 0x7);
+	if (((breakpointBits[addr >> 3] & bit) != 0) == set)
+		return;
+	breakpointBits[addr >> 3] ^= bit;
+	breakpointCount += set ? 1 : -1;
+}
 
-			case 0x0E: // RRC (HL)
-				ROT('R', false, memory[H << 8 | L]);
-				PC += 1;
-				break;
+// Sets or clears a watchpoint for runUntil() on writes to an address. Writes to echo RAM hit watchpoints
+// on the work RAM they alias, and the other way round.
+void gb::setWatchpoint(uint16_t addr, bool set)
+{
+	if (addr >= 0xE000 && addr < 0xFE00)
+		addr -= 0x2000;
+	uint8_t bit = 1 << (addr & 0x7);
+	if (((watchBits[addr >> 3] & bit) != 0) == set)
+		return;
+	watchBits[addr >> 3] ^= bit;
+	watchpointCount += set ? 1 : -1;
+	pageWatchpoints[addr >> 8] += set ? 1 : -1;
+	setPageWatch(addr >> 8, WATCH_DATA, pageWatchpoints[addr >> 8] > 0);
+}
 
-			case 0x0F: // RRC A
-				ROT('R', false, A);
-				PC += 1;
-				break;
-			}
-			break;
+// Runs one instruction, or dispatches an interrupt. With trace set, the CPU state before each
+// instruction is written to output.txt, and everything that would skip over instructions (compiled
+// blocks, cached decoding and idle loop skipping) is turned off so that every one is logged. Without it,
+// the compiler leaves out all of the logging code.
+template <bool trace>
+int gb::runInstruction()
+{
+	// If scheduled to set the IME, check if it should occur on this cycle. If it should, set it, otherwise do it next cycle.
+	if (scheduleIME)
+	{
+		if (cyclesBeforeEnableIME == 1)
+			cyclesBeforeEnableIME = 0;
+		else
+		{
+			EI();
+		}
+	}
 
-		case 0x10: // Rotations with carry.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // RL B
-				ROT('L', true, B);
-				PC += 1;
-				break;
+	// A halted CPU does nothing until an enabled interrupt is requested, whether or not IME is set. Only
+	// events can request one, so skip straight to the next event. With no events at all (LCD and timer
+	// off) the CPU would never wake, so give the frontend a frame's worth of cycles at a time.
+	if (halted)
+	{
+		if (memory[IE] & memory[IF] & 0x1F)
+			halted = false;
+		else
+		{
+			uint64_t skipped = nextEventAt - counter;
+			if (skipped > 17556)
+				skipped = 17556;
+			counter += skipped;
+			if (counter >= nextEventAt)
+				runEvents();
+			return static_cast<int>(skipped);
+		}
+	}
 
-			case 0x01: // RL C
-				ROT('L', true, C);
-				PC += 1;
-				break;
+	// Dispatch the highest priority pending interrupt. This is its own step, taking 5 machine cycles: two
+	// waits, pushing PC and the jump to the vector.
+	if (interruptPending)
+	{
+		uint8_t pending = memory[IE] & memory[IF] & 0x1F;
+		int i = 0;
+		while (!((pending >> i) & 0x1))
+			i++;
+
+		modifyBit(memory[IF], 0, i);
+		DI();
+		writeToMemory(SP - 1, PC >> 8);
+		writeToMemory(SP - 2, PC & 0xFF);
+		SP -= 2;
+		PC = intVectors[i];
+		if (trace)
+			fprintf(pFile, "INTERRUPT %u\n", i);
+
+		cycles = 5;
+		counter += cycles;
+		if (counter >= nextEventAt)
+			runEvents();
+		return cycles;
+	}
 
-			case 0x02: // RL D
-				ROT('L', true, D);
-				PC += 1;
-				break;
+	uint16_t startPC = PC;	// Where this instruction or block starts, to spot jumps back into a loop.
 
-			case 0x03: // RL E
-				ROT('L', true, E);
-				PC += 1;
-				break;
+	// Run a compiled block from PC if there is one. IME changes are handled one instruction at a time by
+	// the interpreter below. Entering a block costs about as much as interpreting an
+	// instruction, so it isn't worth it when an event is due within the next few, as with the fastest timer.
+	if (!trace && backend == JIT && breakpointCount == 0 && !scheduleIME && !haltBug && !dmaActive && nextEventAt - counter >= jitMinRun)
+	{
+		int blockCycles = runJitBlock();
+		if (blockCycles > 0)
+		{
+			if (PC <= startPC && idleLoopSkipping && counter < nextEventAt)
+				blockCycles += skipIdleLoop();
+			if (counter >= nextEventAt)
+				runEvents();
+			return blockCycles;
+		}
+	}
 
-			case 0x04: // RL H
-				ROT('L', true, H);
-				PC += 1;
-				break;
+	// ROM can't change, so the cached interpreter runs instructions there from the records made by
+	// decodeBank() without reading memory. Both this and compiled blocks are left out during OAM DMA, when
+	// the CPU can't read ROM.
+	const decodedInstruction* inst = nullptr;
+	if (!trace && backend != INTERPRETER && PC < 0x8000 && !haltBug && !dmaActive)
+		inst = findDecodedInstruction(PC);
+	if (inst)
+	{
+		imm16 = inst->imm16;
+		cycles = inst->cycles;
+		(this->*inst->handler)();
+	}
+	else
+	{
+		fetchInstruction();	// Get the current opcode and the bytes after it.
 
-			case 0x05: // RL L
-				ROT('L', true, L);
-				PC += 1;
-				break;
+		// After the HALT bug the opcode is read without moving past it, so it is read again as the first
+		// operand, or run a second time if it has none. Moving PC back gives the same result for every
+		// instruction, including the return address of a CALL or RST.
+		if (haltBug)
+		{
+			PC -= 1;
+			imm16 = (readMemory(PC + 2) << 8) | readMemory(PC + 1);
+			haltBug = false;
+		}
+#ifdef GB_PROFILE_PAIRS
+		pairCounts[previousOpcode << 8 | opcode] += 1;
+		previousOpcode = opcode;
+#endif
+
+		// Print the current opcode and other info to the output log if tracing.
+		if (trace)
+			traceInstruction();
+
+		// Run the instruction through the dispatch table. CB-prefixed instructions go through opCB(),
+		// which dispatches a second time on the byte after the prefix and replaces the cycle count.
+		cycles = opCycles[opcode];
+		(this->*opTable[opcode])();
+	}
 
-			case 0x06: // RL (HL)
-				ROT('L', true, memory[H << 8 | L]);
-				PC += 1;
-				break;
+	// Fire any timer, PPU, DMA or serial events that fell due during the instruction.
+	counter += cycles;
+	if (!trace && PC <= startPC && idleLoopSkipping && counter < nextEventAt)
+		cycles += skipIdleLoop();
+	if (counter >= nextEventAt)
+		runEvents();
 
-			case 0x07: // RL A
-				ROT('L', true, A);
-				PC += 1;
-				break;
+	return cycles;
+}
 
-			case 0x08: // RR B
-				ROT('R', true, B);
-				PC += 1;
-				break;
+// Prints the current opcode and CPU state to the output log.
+void gb::traceInstruction()
+{
+	char opcodeStr[3];	// Can store the opcode in a string so it can be printed.
+	F = getF();
+	snprintf(opcodeStr, sizeof(opcodeStr), "%x", opcode);
+	fprintf(pFile,
+		"A: %02X F: %02X B: %02X C: %02X D: %02X E: %02X H: %02X L: %02X SP: %04X PC: 00:%04X (%s %X %X %X)\n",
+		A, F, B, C, D, E, H, L, SP, PC, opcodeStr, readMemory(PC + 1), readMemory(PC + 2), readMemory(PC + 3));
+}
 
-			case 0x09: // RR C
-				ROT('R', true, C);
-				PC += 1;
-				break;
+#ifdef GB_THREADED
+// Runs instructions as runInstruction() does until the counter reaches end, using labels as values (a
+// GCC and Clang extension). Every handler is followed by its own copy of the code that fetches the next
+// opcode and jumps straight to its label, so each of those jumps is predicted on its own and the
+// predictor can learn which instruction tends to follow which. Only the common case is handled here.
+// Interrupts, EI, HALT and the HALT bug go through runInstruction(), and the loop also returns when an
+// event sets a flag runUntil() may be waiting for.
+template <bool trace>
+void gb::runThreaded(uint64_t end)
+{
+	if (interruptPending || scheduleIME || halted || haltBug)
+	{
+		runInstruction<trace>();
+		return;
+	}
 
-			case 0x0A: // RR D
-				ROT('R', true, D);
-				PC += 1;
-				break;
+#define GB_LABEL_ADDRESS(n) &&label##n,
+	static void* const labels[256] = { GB_ALL_OPCODES(GB_LABEL_ADDRESS) };
+#undef GB_LABEL_ADDRESS
+
+	uint16_t startPC;
+
+#define GB_DISPATCH \
+	startPC = PC; \
+	fetchInstruction(); \
+	if (trace) \
+		traceInstruction(); \
+	cycles = opCycles[opcode]; \
+	goto *labels[opcode];
+
+#define GB_HANDLER(n) \
+	label##n: \
+	op##n(); \
+	counter += cycles; \
+	if (!trace && PC <= startPC && idleLoopSkipping && counter < nextEventAt) \
+		skipIdleLoop(); \
+	if (counter >= nextEventAt && runEventsForThreaded()) \
+		return; \
+	if (counter >= end || interruptPending || scheduleIME || halted || haltBug) \
+		return; \
+	GB_DISPATCH
+
+	GB_DISPATCH
+	GB_ALL_OPCODES(GB_HANDLER)
+
+#undef GB_HANDLER
+#undef GB_DISPATCH
+}
 
-			case 0x0B: // RR E
-				ROT('R', true, E);
-				PC += 1;
-				break;
 
-			case 0x0C: // RR H
-				ROT('R', true, H);
-				PC += 1;
-				break;
+// Runs the events that are due for runThreaded(). Returns true if one of them set a flag that
+// runUntil() can stop for.
+bool gb::runEventsForThreaded()
+{
+	bool wasLineReady = lineReady;
+	bool wasFrameReady = frameReady;
+	bool wasSerialDone = serialDone;
+	runEvents();
+	return lineReady != wasLineReady || frameReady != wasFrameReady || serialDone != wasSerialDone;
+}
+#endif
+
+// Called after a jump backwards. If the CPU is back at the same address in the same state as the last
+// time it jumped there, and nothing has written to memory since, then the loop between can only do the
+// same thing again until an event changes memory. Such polling loops (e.g. waiting for LY) are run
+// forward by whole iterations, which is exactly as if they had been emulated. Returns the machine
+// cycles skipped. Nothing is skipped while breakpoints are set, as one could be inside the loop.
+int gb::skipIdleLoop()
+{
+	if (scheduleIME || dmaActive || breakpointCount > 0)
+		return 0;
 
-			case 0x0D: // RR L
-				ROT('R', true, L);
-				PC += 1;
-				break;
+	uint8_t f = getF();
+	idleLoopState& last = idleLoop;
+	if (!last.valid || last.PC != PC || last.A != A || last.F != f || last.BC != BC || last.DE != DE ||
+		last.HL != HL || last.SP != SP || last.IME != IME || counter - last.counter > 17556)
+	{
+		last.valid = true;
+		last.PC = PC;
+		last.A = A;
+		last.F = f;
+		last.BC = BC;
+		last.DE = DE;
+		last.HL = HL;
+		last.SP = SP;
+		last.IME = IME;
+		last.counter = counter;
+		return 0;
+	}
 
-			case 0x0E: // RR (HL)
-				ROT('R', true, memory[H << 8 | L]);
-				PC += 1;
-				break;
+	uint64_t period = counter - last.counter;
+	uint64_t start = counter;
+	uint64_t limit = counter + 17556;	// Stop after a frame's worth so the frontend still gets control back.
+	uint16_t reads[4];
+	int readCount = findIdleLoopReads(PC, reads);
 
-			case 0x0F: // RR A
-				ROT('R', true, A);
-				PC += 1;
-				break;
-			}
+	for (;;)
+	{
+		// Run forward by whole iterations up to the next event.
+		uint64_t until = (nextEventAt < limit ? nextEventAt : limit) - counter;
+		counter += until / period * period;
+		if (readCount < 0 || nextEventAt >= limit)
 			break;
 
-		case 0x20: // Arithmetic shifts.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // SLA B
-				SHIFT('L', B);
-				PC += 1;
-				break;
-
-			case 0x01: // SLA C
-				SHIFT('L', C);
-				PC += 1;
-				break;
+		// The next event is due during the next iteration. If it leaves everything the loop reads alone
+		// and doesn't cause an interrupt, the loop can't tell when it happened, so run it now and carry
+		// on. Otherwise undo it and leave that iteration to be emulated. The frontend also has to see
+		// each line and frame as it is finished.
+		uint8_t ioBackup[0x200];
+		scheduledEvent heapBackup[EVENT_COUNT];
+		int heapPosBackup[EVENT_COUNT];
+		uint8_t readValues[4];
+		memcpy(ioBackup, &memory[0xFE00], sizeof(ioBackup));
+		memcpy(heapBackup, eventHeap, sizeof(heapBackup));
+		memcpy(heapPosBackup, eventHeapPos, sizeof(heapPosBackup));
+		int eventCountBackup = eventCount;
+		uint64_t nextEventBackup = nextEventAt;
+		bool lineReadyBackup = lineReady;
+		bool frameReadyBackup = frameReady;
+		bool serialDoneBackup = serialDone;
+		uint8_t serialByteBackup = serialByte;
+		uint64_t timaUpdatedAtBackup = timaUpdatedAt;
+		int framesSinceSaveBackup = framesSinceSave;
+		uint64_t rtcSecondsBackup = rtcSeconds;
+		uint64_t rtcUpdatedAtBackup = rtcUpdatedAt;
+		bool rtcCarryBackup = rtcCarry;
+		for (int i = 0; i < readCount; i++)
+			readValues[i] = readMemory(reads[i]);
+
+		uint64_t now = counter;
+		counter = nextEventAt;
+		runEvents();
+		counter = now;
+
+		bool unchanged = !interruptPending && lineReady == lineReadyBackup && frameReady == frameReadyBackup &&
+			serialDone == serialDoneBackup;
+		for (int i = 0; i < readCount; i++)
+			unchanged = unchanged && readMemory(reads[i]) == readValues[i];
+		if (!unchanged)
+		{
+			memcpy(&memory[0xFE00], ioBackup, sizeof(ioBackup));
+			memcpy(eventHeap, heapBackup, sizeof(heapBackup));
+			memcpy(eventHeapPos, heapPosBackup, sizeof(heapPosBackup));
+			eventCount = eventCountBackup;
+			nextEventAt = nextEventBackup;
+			lineReady = lineReadyBackup;
+			frameReady = frameReadyBackup;
+			serialDone = serialDoneBackup;
+			serialByte = serialByteBackup;
+			timaUpdatedAt = timaUpdatedAtBackup;
+			framesSinceSave = framesSinceSaveBackup;
+			rtcSeconds = rtcSecondsBackup;
+			rtcUpdatedAt = rtcUpdatedAtBackup;
+			rtcCarry = rtcCarryBackup;
+			updateInterrupts();
+			break;
+		}
+	}
 
-			case 0x02: // SLA D
-				SHIFT('L', D);
-				PC += 1;
-				break;
+	last.valid = true;
+	last.counter = counter;
+	return static_cast<int>(counter - start);
+}
 
-			case 0x03: // SLA E
-				SHIFT('L', E);
-				PC += 1;
-				break;
+// Works out which memory the loop starting at an address reads, if it is a simple polling loop: a
+// few instructions that only load into and test A, ending with a jump back to the start. Register
+// pairs used as addresses can't change in such a loop. Returns the number of addresses read, or -1 if
+// the loop is anything else.
+int gb::findIdleLoopReads(uint16_t start, uint16_t reads[4])
+{
+	int count = 0;
+	uint16_t pc = start;
+	for (int i = 0; i < 16; i++)
+	{
+		uint8_t op = readMemory(pc);
+		uint16_t operand = (readMemory(pc + 2) << 8) | readMemory(pc + 1);
+		int read = -1;
 
-			case 0x04: // SLA H
-				SHIFT('L', H);
-				PC += 1;
-				break;
+		switch (op)
+		{
+		case 0xF0:	// LDH A, (a8)
+			read = 0xFF00 | (operand & 0xFF);
+			break;
+		case 0xF2:	// LD A, (C)
+			read = 0xFF00 | C;
+			break;
+		case 0xFA:	// LD A, (a16)
+			read = operand;
+			break;
+		case 0x0A:	// LD A, (BC)
+			read = BC;
+			break;
+		case 0x1A:	// LD A, (DE)
+			read = DE;
+			break;
+		case 0x7E: case 0x86: case 0x8E: case 0x96: case 0x9E: case 0xA6: case 0xAE: case 0xB6: case 0xBE:	// A and (HL)
+			read = HL;
+			break;
+		case 0xCB:	// Only BIT, which changes no registers.
+			if ((operand & 0xC0) != 0x40)
+				return -1;
+			if ((operand & 0x07) == 0x06)
+				read = HL;
+			break;
+		case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:	// JR
+			return static_cast<uint16_t>(pc + 2 + static_cast<int8_t>(operand & 0xFF)) == start ? count : -1;
+		case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:	// JP
+			return operand == start ? count : -1;
+		case 0x00: case 0x07: case 0x0F: case 0x17: case 0x1F: case 0x27: case 0x2F: case 0x37: case 0x3F:
+		case 0x3C: case 0x3D: case 0x3E: case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+			break;
+		default:
+			// LD A, r and the ALU ops on registers only change A and F.
+			if (!(op >= 0x78 && op <= 0xBF))
+				return -1;
+			break;
+		}
 
-			case 0x05: // SLA L
-				SHIFT('L', L);
-				PC += 1;
-				break;
+		if (read >= 0)
+		{
+			if (count == 4)
+				return -1;
+			reads[count++] = static_cast<uint16_t>(read);
+		}
+		pc += opLengths[op];
+	}
+	return -1;
+}
 
-			case 0x06: // SLA (HL)
-				SHIFT('L', memory[H << 8 | L]);
-				PC += 1;
-				break;
+// Requests an interrupt by setting its bit in IF.
+void gb::requestInterrupt(int bit)
+{
+	memory[IF] |= 1 << bit;
+	updateInterrupts();
+}
 
-			case 0x07: // SLA A
-				SHIFT('L', A);
-				PC += 1;
-				break;
+// Works out whether an interrupt should be dispatched before the next instruction. Called whenever IF,
+// IE or IME changes, so that emulateCycle only has to test one flag.
+void gb::updateInterrupts()
+{
+	interruptPending = IME && (memory[IE] & memory[IF] & 0x1F);
+}
 
-			case 0x08: // SRA B
-				SHIFT('R', B);
-				PC += 1;
-				break;
+// Brings TIMA in memory up to date with the counter. TIMA increments on each multiple of the period TAC
+// selects, so the increments since it was last brought up to date can be counted without running them.
+// It can't have overflowed in the meantime, as TIMER_EVENT handles that.
+void gb::updateTima()
+{
+	if ((memory[TAC] >> 2) & 0x1)
+	{
+		uint64_t period = timerPeriods[memory[TAC] & 0x3];
+		memory[TIMA] += static_cast<uint8_t>(counter / period - timaUpdatedAt / period);
+	}
+	timaUpdatedAt = counter;
+}
 
-			case 0x09: // SRA C
-				SHIFT('R', C);
-				PC += 1;
-				break;
+// Works out the JOYP register from the buttons held down and the group the game has selected. A 0 bit
+// selects a group (bit 4 the D-pad, bit 5 the buttons) and a 0 bit reads as pressed.
+uint8_t gb::readJoypad()
+{
+	uint8_t select = memory[JOYP] & 0x30;
+	uint8_t buttons = 0x0F;
+	if (!(select & 0x10))
+		buttons &= ~joypad & 0x0F;
+	if (!(select & 0x20))
+		buttons &= ~(joypad >> 4);
+	return 0xC0 | select | buttons;
+}
 
-			case 0x0A: // SRA D
-				SHIFT('R', D);
-				PC += 1;
-				break;
+// Sets the buttons held down, as a combination of joypadButton. The game sees them when it next reads
+// JOYP. A newly pressed button in a selected group requests the joypad interrupt.
+void gb::setJoypad(uint8_t pressed)
+{
+	uint8_t before = readJoypad();
+	joypad = pressed;
+	if (before & ~readJoypad() & 0x0F)
+		requestInterrupt(4);	// Joypad interrupt.
+}
 
-			case 0x0B: // SRA E
-				SHIFT('R', E);
-				PC += 1;
-				break;
+// Schedules an event to fire once the counter reaches the given cycle, replacing any deadline
+// the event already had.
+void gb::scheduleEvent(eventType type, uint64_t when)
+{
+	int pos = eventHeapPos[type];
+	if (pos < 0)
+	{
+		pos = eventCount++;
+		eventHeap[pos].type = type;
+		eventHeapPos[type] = pos;
+	}
+	eventHeap[pos].when = when;
 
-			case 0x0C: // SRA H
-				SHIFT('R', H);
-				PC += 1;
-				break;
+	// The new deadline may be earlier or later than the old one, so restore the heap both ways.
+	siftEventUp(pos);
+	siftEventDown(eventHeapPos[type]);
+	nextEventAt = eventHeap[0].when;
+}
 
-			case 0x0D: // SRA L
-				SHIFT('R', L);
-				PC += 1;
-				break;
+// Removes a pending event so that it does not fire.
+void gb::cancelEvent(eventType type)
+{
+	int pos = eventHeapPos[type];
+	if (pos < 0)
+		return;
 
-			case 0x0E: // SRA (HL)
-				SHIFT('R', memory[H << 8 | L]);
-				PC += 1;
-				break;
+	// Move the last event into the gap and restore the heap around it.
+	eventHeapPos[type] = -1;
+	eventCount -= 1;
+	if (pos != eventCount)
+	{
+		eventHeap[pos] = eventHeap[eventCount];
+		eventHeapPos[eventHeap[pos].type] = pos;
+		siftEventUp(pos);
+		siftEventDown(eventHeapPos[eventHeap[pos].type]);
+	}
+	nextEventAt = eventCount > 0 ? eventHeap[0].when : UINT64_MAX;
+}
 
-			case 0x0F: // SRA A
-				SHIFT('R', A);
-				PC += 1;
-				break;
-			}
+// Moves a heap entry towards the root until its parent is due no later than it.
+void gb::siftEventUp(int pos)
+{
+	while (pos > 0)
+	{
+		int parent = (pos - 1) / 2;
+		if (eventHeap[parent].when <= eventHeap[pos].when)
 			break;
+		swapEvents(pos, parent);
+		pos = parent;
+	}
+}
 
-		case 0x30: // Swaps and logical right shifts.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // SWAP B
-				SWAP(B);
-				PC += 1;
-				break;
+// Moves a heap entry towards the leaves until both children are due no earlier than it.
+void gb::siftEventDown(int pos)
+{
+	for (;;)
+	{
+		int smallest = pos;
+		int left = pos * 2 + 1;
+		int right = left + 1;
+		if (left < eventCount && eventHeap[left].when < eventHeap[smallest].when)
+			smallest = left;
+		if (right < eventCount && eventHeap[right].when < eventHeap[smallest].when)
+			smallest = right;
+		if (smallest == pos)
+			break;
+		swapEvents(pos, smallest);
+		pos = smallest;
+	}
+}
 
-			case 0x01: // SWAP C
-				SWAP(C);
-				PC += 1;
-				break;
+// Swaps two heap entries and updates their recorded positions.
+void gb::swapEvents(int a, int b)
+{
+	scheduledEvent temp = eventHeap[a];
+	eventHeap[a] = eventHeap[b];
+	eventHeap[b] = temp;
+	eventHeapPos[eventHeap[a].type] = a;
+	eventHeapPos[eventHeap[b].type] = b;
+}
 
-			case 0x02: // SWAP D
-				SWAP(D);
-				PC += 1;
-				break;
+// Fires every event whose deadline has been reached, in deadline order. Periodic events reschedule
+// themselves from the cycle they were due on, so they do not drift; one-shot events are removed.
+void gb::runEvents()
+{
+	idleLoop.valid = false;	// Events change memory without going through writeToMemory().
+	while (eventCount > 0 && eventHeap[0].when <= counter)
+	{
+		scheduledEvent event = eventHeap[0];
 
-			case 0x03: // SWAP E
-				SWAP(E);
-				PC += 1;
-				break;
+		switch (event.type)
+		{
+		case TIMER_EVENT: // TIMA has overflowed. It is reloaded from TMA and counts up from there.
+			memory[TIMA] = memory[TMA];
+			timaUpdatedAt = event.when;
+			requestInterrupt(2); // Timer interrupt.
+			updateTimerEvent();
+			break;
 
-			case 0x04: // SWAP H
-				SWAP(H);
-				PC += 1;
-				break;
+		case PPU_EVENT:
+			ppuEvent(event.when);
+			break;
 
-			case 0x05: // SWAP L
-				SWAP(L);
-				PC += 1;
-				break;
+		case DMA_EVENT: // Give the CPU the bus back and copy the source into OAM in one go.
+			cancelEvent(DMA_EVENT);
+			dmaActive = false;
+			mapMemory();
+			memcpy(&memory[0xFE00], readPages[dmaSource], 0xA0);
+			break;
 
-			case 0x06: // SWAP (HL)
-				SWAP(memory[H << 8 | L]);
-				PC += 1;
-				break;
+		case SERIAL_EVENT: // No link partner is connected, so the byte shifted in is always 0xFF.
+			cancelEvent(SERIAL_EVENT);
+			serialByte = memory[SB];
+			serialDone = true;
+			memory[SB] = 0xFF;
+			modifyBit(memory[SC], 0, 7);
+			requestInterrupt(3); // Serial interrupt.
+			break;
 
-			case 0x07: // SWAP A
-				SWAP(A);
-				PC += 1;
-				break;
+		default:
+			cancelEvent(event.type);
+			break;
+		}
+	}
+}
 
-			case 0x08: // SRL B
-				SHIFT('l', B);
-				PC += 1;
-				break;
+// Schedules TIMER_EVENT for when TIMA next overflows, or cancels it if the timer is off. TIMA must be up
+// to date as of timaUpdatedAt.
+void gb::updateTimerEvent()
+{
+	if ((memory[TAC] >> 2) & 0x1)
+	{
+		uint64_t period = timerPeriods[memory[TAC] & 0x3];
+		scheduleEvent(TIMER_EVENT, (timaUpdatedAt / period + 0x100 - memory[TIMA]) * period);
+	}
+	else
+		cancelEvent(TIMER_EVENT);
+}
 
-			case 0x09: // SRL C
-				SHIFT('l', C);
-				PC += 1;
-				break;
-
-			case 0x0A: // SRL D
-				SHIFT('l', D);
-				PC += 1;
-				break;
-
-			case 0x0B: // SRL E
-				SHIFT('l', E);
-				PC += 1;
-				break;
-
-			case 0x0C: // SRL H
-				SHIFT('l', H);
-				PC += 1;
-				break;
-
-			case 0x0D: // SRL L
-				SHIFT('l', L);
-				PC += 1;
-				break;
-
-			case 0x0E: // SRL (HL)
-				SHIFT('l', memory[H << 8 | L]);
-				PC += 1;
-				break;
-
-			case 0x0F: // SRL A
-				SHIFT('l', A);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0x40: // Test bits 0 and 1.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // BIT 0, B
-				BIT(0, B);
-				PC += 1;
-				break;
-
-			case 0x01: // BIT 0, C
-				BIT(0, C);
-				PC += 1;
-				break;
-
-			case 0x02: // BIT 0, D
-				BIT(0, D);
-				PC += 1;
-				break;
-
-			case 0x03: // BIT 0, E
-				BIT(0, E);
-				PC += 1;
-				break;
-
-			case 0x04: // BIT 0, H
-				BIT(0, H);
-				PC += 1;
-				break;
-
-			case 0x05: // BIT 0, L
-				BIT(0, L);
-				PC += 1;
-				break;
-
-			case 0x06: // BIT 0, (HL)
-				BIT(0, memory[H << 8 | L]);
-				PC += 1;
-				break;
-
-			case 0x07: // BIT 0, A
-				BIT(0, A);
-				PC += 1;
-				break;
-
-			case 0x08: // BIT 1, B
-				BIT(1, B);
-				PC += 1;
-				break;
-
-			case 0x09: // BIT 1, C
-				BIT(1, C);
-				PC += 1;
-				break;
-
-			case 0x0A: // BIT 1, D
-				BIT(1, D);
-				PC += 1;
-				break;
-
-			case 0x0B: // BIT 1, E
-				BIT(1, E);
-				PC += 1;
-				break;
-
-			case 0x0C: // BIT 1, H
-				BIT(1, H);
-				PC += 1;
-				break;
-
-			case 0x0D: // BIT 1, L
-				BIT(1, L);
-				PC += 1;
-				break;
-
-			case 0x0E: // BIT 1, (HL)
-				BIT(1, memory[H << 8 | L]);
-				PC += 1;
-				break;
-
-			case 0x0F: // BIT 1, A
-				BIT(1, A);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0x50: // Test bits 2 and 3.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // BIT 2, B
-				BIT(2, B);
-				PC += 1;
-				break;
-
-			case 0x01: // BIT 2, C
-				BIT(2, C);
-				PC += 1;
-				break;
-
-			case 0x02: // BIT 2, D
-				BIT(2, D);
-				PC += 1;
-				break;
-
-			case 0x03: // BIT 2, E
-				BIT(2, E);
-				PC += 1;
-				break;
-
-			case 0x04: // BIT 2, H
-				BIT(2, H);
-				PC += 1;
-				break;
-
-			case 0x05: // BIT 2, L
-				BIT(2, L);
-				PC += 1;
-				break;
-
-			case 0x06: // BIT 2, (HL)
-				BIT(2, memory[H << 8 | L]);
-				PC += 1;
-				break;
-
-			case 0x07: // BIT 2, A
-				BIT(2, A);
-				PC += 1;
-				break;
-
-			case 0x08: // BIT 3, B
-				BIT(3, B);
-				PC += 1;
-				break;
-
-			case 0x09: // BIT 3, C
-				BIT(3, C);
-				PC += 1;
-				break;
-
-			case 0x0A: // BIT 3, D
-				BIT(3, D);
-				PC += 1;
-				break;
-
-			case 0x0B: // BIT 3, E
-				BIT(3, E);
-				PC += 1;
-				break;
-
-			case 0x0C: // BIT 3, H
-				BIT(3, H);
-				PC += 1;
-				break;
-
-			case 0x0D: // BIT 3, L
-				BIT(3, L);
-				PC += 1;
-				break;
-
-			case 0x0E: // BIT 3, (HL)
-				BIT(3, memory[H << 8 | L]);
-				PC += 1;
-				break;
-
-			case 0x0F: // BIT 3, A
-				BIT(3, A);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0x60: // Test bits 4 and 5.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // BIT 4, B
-				BIT(4, B);
-				PC += 1;
-				break;
-
-			case 0x01: // BIT 4, C
-				BIT(4, C);
-				PC += 1;
-				break;
-
-			case 0x02: // BIT 4, D
-				BIT(4, D);
-				PC += 1;
-				break;
-
-			case 0x03: // BIT 4, E
-				BIT(4, E);
-				PC += 1;
-				break;
-
-			case 0x04: // BIT 4, H
-				BIT(4, H);
-				PC += 1;
-				break;
-
-			case 0x05: // BIT 4, L
-				BIT(4, L);
-				PC += 1;
-				break;
-
-			case 0x06: // BIT 4, (HL)
-				BIT(4, memory[H << 8 | L]);
-				PC += 1;
-				break;
-
-			case 0x07: // BIT 4, A
-				BIT(4, A);
-				PC += 1;
-				break;
-
-			case 0x08: // BIT 5, B
-				BIT(5, B);
-				PC += 1;
-				break;
-
-			case 0x09: // BIT 5, C
-				BIT(5, C);
-				PC += 1;
-				break;
-
-			case 0x0A: // BIT 5, D
-				BIT(5, D);
-				PC += 1;
-				break;
-
-			case 0x0B: // BIT 5, E
-				BIT(5, E);
-				PC += 1;
-				break;
-
-			case 0x0C: // BIT 5, H
-				BIT(5, H);
-				PC += 1;
-				break;
-
-			case 0x0D: // BIT 5, L
-				BIT(5, L);
-				PC += 1;
-				break;
-
-			case 0x0E: // BIT 5, (HL)
-				BIT(5, memory[H << 8 | L]);
-				PC += 1;
-				break;
-
-			case 0x0F: // BIT 5, A
-				BIT(5, A);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0x70: // Test bits 6 and 7.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // BIT 6, B
-				BIT(6, B);
-				PC += 1;
-				break;
-
-			case 0x01: // BIT 6, C
-				BIT(6, C);
-				PC += 1;
-				break;
-
-			case 0x02: // BIT 6, D
-				BIT(6, D);
-				PC += 1;
-				break;
-
-			case 0x03: // BIT 6, E
-				BIT(6, E);
-				PC += 1;
-				break;
-
-			case 0x04: // BIT 6, H
-				BIT(6, H);
-				PC += 1;
-				break;
-
-			case 0x05: // BIT 6, L
-				BIT(6, L);
-				PC += 1;
-				break;
-
-			case 0x06: // BIT 6, (HL)
-				BIT(6, memory[H << 8 | L]);
-				PC += 1;
-				break;
-
-			case 0x07: // BIT 6, A
-				BIT(6, A);
-				PC += 1;
-				break;
-
-			case 0x08: // BIT 7, B
-				BIT(7, B);
-				PC += 1;
-				break;
-
-			case 0x09: // BIT 7, C
-				BIT(7, C);
-				PC += 1;
-				break;
-
-			case 0x0A: // BIT 7, D
-				BIT(7, D);
-				PC += 1;
-				break;
-
-			case 0x0B: // BIT 7, E
-				BIT(7, E);
-				PC += 1;
-				break;
-
-			case 0x0C: // BIT 7, H
-				BIT(7, H);
-				PC += 1;
-				break;
-
-			case 0x0D: // BIT 7, L
-				BIT(7, L);
-				PC += 1;
-				break;
-
-			case 0x0E: // BIT 7, (HL)
-				BIT(7, memory[H << 8 | L]);
-				PC += 1;
-				break;
-
-			case 0x0F: // BIT 7, A
-				BIT(7, A);
-				PC += 1;
-				break;
-			}
-			break;
-		
-		case 0x80: // Reset bits 0 and 1.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // RES 0, B
-				modifyBit(B, 0, 0);
-				PC += 1;
-				break;
-
-			case 0x01: // RES 0, C
-				modifyBit(C, 0, 0);
-				PC += 1;
-				break;
-
-			case 0x02: // RES 0, D
-				modifyBit(D, 0, 0);
-				PC += 1;
-				break;
-
-			case 0x03: // RES 0, E
-				modifyBit(E, 0, 0);
-				PC += 1;
-				break;
-
-			case 0x04: // RES 0, H
-				modifyBit(H, 0, 0);
-				PC += 1;
-				break;
-
-			case 0x05: // RES 0, L
-				modifyBit(L, 0, 0);
-				PC += 1;
-				break;
-
-			case 0x06: // RES 0, (HL)
-				modifyBit(memory[H << 8 | L], 0, 0);
-				PC += 1;
-				break;
-
-			case 0x07: // RES 0, A
-				modifyBit(A, 0, 0);
-				PC += 1;
-				break;
-
-			case 0x08: // RES 1, B
-				modifyBit(B, 0, 1);
-				PC += 1;
-				break;
-
-			case 0x09: // RES 1, C
-				modifyBit(C, 0, 1);
-				PC += 1;
-				break;
-
-			case 0x0A: // RES 1, D
-				modifyBit(D, 0, 1);
-				PC += 1;
-				break;
-
-			case 0x0B: // RES 1, E
-				modifyBit(E, 0, 1);
-				PC += 1;
-				break;
-
-			case 0x0C: // RES 1, H
-				modifyBit(H, 0, 1);
-				PC += 1;
-				break;
-
-			case 0x0D: // RES 1, L
-				modifyBit(L, 0, 1);
-				PC += 1;
-				break;
-
-			case 0x0E: // RES 1, (HL)
-				modifyBit(memory[H << 8 | L], 0, 1);
-				PC += 1;
-				break;
-
-			case 0x0F: // RES 1, A
-				modifyBit(A, 0, 1);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0x90: // Reset bits 2 and 3.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // RES 2, B
-				modifyBit(B, 0, 2);
-				PC += 1;
-				break;
-
-			case 0x01: // RES 2, C
-				modifyBit(C, 0, 2);
-				PC += 1;
-				break;
-
-			case 0x02: // RES 2, D
-				modifyBit(D, 0, 2);
-				PC += 1;
-				break;
-
-			case 0x03: // RES 2, E
-				modifyBit(E, 0, 2);
-				PC += 1;
-				break;
-
-			case 0x04: // RES 2, H
-				modifyBit(H, 0, 2);
-				PC += 1;
-				break;
-
-			case 0x05: // RES 2, L
-				modifyBit(L, 0, 2);
-				PC += 1;
-				break;
-
-			case 0x06: // RES 2, (HL)
-				modifyBit(memory[H << 8 | L], 0, 2);
-				PC += 1;
-				break;
-
-			case 0x07: // RES 2, A
-				modifyBit(A, 0, 2);
-				PC += 1;
-				break;
-
-			case 0x08: // RES 3, B
-				modifyBit(B, 0, 3);
-				PC += 1;
-				break;
-
-			case 0x09: // RES 3, C
-				modifyBit(C, 0, 3);
-				PC += 1;
-				break;
-
-			case 0x0A: // RES 3, D
-				modifyBit(D, 0, 3);
-				PC += 1;
-				break;
-
-			case 0x0B: // RES 3, E
-				modifyBit(E, 0, 3);
-				PC += 1;
-				break;
-
-			case 0x0C: // RES 3, H
-				modifyBit(H, 0, 3);
-				PC += 1;
-				break;
-
-			case 0x0D: // RES 3, L
-				modifyBit(L, 0, 3);
-				PC += 1;
-				break;
-
-			case 0x0E: // RES 3, (HL)
-				modifyBit(memory[H << 8 | L], 0, 3);
-				PC += 1;
-				break;
-
-			case 0x0F: // RES 3, A
-				modifyBit(A, 0, 3);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0xA0: // Reset bits 4 and 5.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // RES 4, B
-				modifyBit(B, 0, 4);
-				PC += 1;
-				break;
-
-			case 0x01: // RES 4, C
-				modifyBit(C, 0, 4);
-				PC += 1;
-				break;
-
-			case 0x02: // RES 4, D
-				modifyBit(D, 0, 4);
-				PC += 1;
-				break;
-
-			case 0x03: // RES 4, E
-				modifyBit(E, 0, 4);
-				PC += 1;
-				break;
-
-			case 0x04: // RES 4, H
-				modifyBit(H, 0, 4);
-				PC += 1;
-				break;
-
-			case 0x05: // RES 4, L
-				modifyBit(L, 0, 4);
-				PC += 1;
-				break;
-
-			case 0x06: // RES 4, (HL)
-				modifyBit(memory[H << 8 | L], 0, 4);
-				PC += 1;
-				break;
-
-			case 0x07: // RES 4, A
-				modifyBit(A, 0, 4);
-				PC += 1;
-				break;
-
-			case 0x08: // RES 5, B
-				modifyBit(B, 0, 5);
-				PC += 1;
-				break;
-
-			case 0x09: // RES 5, C
-				modifyBit(C, 0, 5);
-				PC += 1;
-				break;
-
-			case 0x0A: // RES 5, D
-				modifyBit(D, 0, 5);
-				PC += 1;
-				break;
-
-			case 0x0B: // RES 5, E
-				modifyBit(E, 0, 5);
-				PC += 1;
-				break;
-
-			case 0x0C: // RES 5, H
-				modifyBit(H, 0, 5);
-				PC += 1;
-				break;
-
-			case 0x0D: // RES 5, L
-				modifyBit(L, 0, 5);
-				PC += 1;
-				break;
-
-			case 0x0E: // RES 5, (HL)
-				modifyBit(memory[H << 8 | L], 0, 5);
-				PC += 1;
-				break;
-
-			case 0x0F: // RES 5, A
-				modifyBit(A, 0, 5);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0xB0: // Reset bits 6 and 7.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // RES 6, B
-				modifyBit(B, 0, 6);
-				PC += 1;
-				break;
-
-			case 0x01: // RES 6, C
-				modifyBit(C, 0, 6);
-				PC += 1;
-				break;
-
-			case 0x02: // RES 6, D
-				modifyBit(D, 0, 6);
-				PC += 1;
-				break;
-
-			case 0x03: // RES 6, E
-				modifyBit(E, 0, 6);
-				PC += 1;
-				break;
-
-			case 0x04: // RES 6, H
-				modifyBit(H, 0, 6);
-				PC += 1;
-				break;
-
-			case 0x05: // RES 6, L
-				modifyBit(L, 0, 6);
-				PC += 1;
-				break;
-
-			case 0x06: // RES 6, (HL)
-				modifyBit(memory[H << 8 | L], 0, 6);
-				PC += 1;
-				break;
-
-			case 0x07: // RES 6, A
-				modifyBit(A, 0, 6);
-				PC += 1;
-				break;
-
-			case 0x08: // RES 7, B
-				modifyBit(B, 0, 7);
-				PC += 1;
-				break;
-
-			case 0x09: // RES 7, C
-				modifyBit(C, 0, 7);
-				PC += 1;
-				break;
-
-			case 0x0A: // RES 7, D
-				modifyBit(D, 0, 7);
-				PC += 1;
-				break;
-
-			case 0x0B: // RES 7, E
-				modifyBit(E, 0, 7);
-				PC += 1;
-				break;
-
-			case 0x0C: // RES 7, H
-				modifyBit(H, 0, 7);
-				PC += 1;
-				break;
-
-			case 0x0D: // RES 7, L
-				modifyBit(L, 0, 7);
-				PC += 1;
-				break;
-
-			case 0x0E: // RES 7, (HL)
-				modifyBit(memory[H << 8 | L], 0, 7);
-				PC += 1;
-				break;
-
-			case 0x0F: // RES 7, A
-				modifyBit(A, 0, 7);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0xC0: // Set bits 0 and 1.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // SET 0, B
-				modifyBit(B, 1, 0);
-				PC += 1;
-				break;
-
-			case 0x01: // SET 0, C
-				modifyBit(C, 1, 0);
-				PC += 1;
-				break;
-
-			case 0x02: // SET 0, D
-				modifyBit(D, 1, 0);
-				PC += 1;
-				break;
-
-			case 0x03: // SET 0, E
-				modifyBit(E, 1, 0);
-				PC += 1;
-				break;
-
-			case 0x04: // SET 0, H
-				modifyBit(H, 1, 0);
-				PC += 1;
-				break;
-
-			case 0x05: // SET 0, L
-				modifyBit(L, 1, 0);
-				PC += 1;
-				break;
-
-			case 0x06: // SET 0, (HL)
-				modifyBit(memory[H << 8 | L], 1, 0);
-				PC += 1;
-				break;
-
-			case 0x07: // SET 0, A
-				modifyBit(A, 1, 0);
-				PC += 1;
-				break;
-
-			case 0x08: // SET 1, B
-				modifyBit(B, 1, 1);
-				PC += 1;
-				break;
-
-			case 0x09: // SET 1, C
-				modifyBit(C, 1, 1);
-				PC += 1;
-				break;
-
-			case 0x0A: // SET 1, D
-				modifyBit(D, 1, 1);
-				PC += 1;
-				break;
-
-			case 0x0B: // SET 1, E
-				modifyBit(E, 1, 1);
-				PC += 1;
-				break;
-
-			case 0x0C: // SET 1, H
-				modifyBit(H, 1, 1);
-				PC += 1;
-				break;
-
-			case 0x0D: // SET 1, L
-				modifyBit(L, 1, 1);
-				PC += 1;
-				break;
-
-			case 0x0E: // SET 1, (HL)
-				modifyBit(memory[H << 8 | L], 1, 1);
-				PC += 1;
-				break;
-
-			case 0x0F: // SET 1, A
-				modifyBit(A, 1, 1);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0xD0: // Set bits 2 and 3.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // SET 2, B
-				modifyBit(B, 1, 2);
-				PC += 1;
-				break;
-
-			case 0x01: // SET 2, C
-				modifyBit(C, 1, 2);
-				PC += 1;
-				break;
-
-			case 0x02: // SET 2, D
-				modifyBit(D, 1, 2);
-				PC += 1;
-				break;
-
-			case 0x03: // SET 2, E
-				modifyBit(E, 1, 2);
-				PC += 1;
-				break;
-
-			case 0x04: // SET 2, H
-				modifyBit(H, 1, 2);
-				PC += 1;
-				break;
-
-			case 0x05: // SET 2, L
-				modifyBit(L, 1, 2);
-				PC += 1;
-				break;
-
-			case 0x06: // SET 2, (HL)
-				modifyBit(memory[H << 8 | L], 1, 2);
-				PC += 1;
-				break;
-
-			case 0x07: // SET 2, A
-				modifyBit(A, 1, 2);
-				PC += 1;
-				break;
-
-			case 0x08: // SET 3, B
-				modifyBit(B, 1, 3);
-				PC += 1;
-				break;
-
-			case 0x09: // SET 3, C
-				modifyBit(C, 1, 3);
-				PC += 1;
-				break;
-
-			case 0x0A: // SET 3, D
-				modifyBit(D, 1, 3);
-				PC += 1;
-				break;
-
-			case 0x0B: // SET 3, E
-				modifyBit(E, 1, 3);
-				PC += 1;
-				break;
-
-			case 0x0C: // SET 3, H
-				modifyBit(H, 1, 3);
-				PC += 1;
-				break;
-
-			case 0x0D: // SET 3, L
-				modifyBit(L, 1, 3);
-				PC += 1;
-				break;
-
-			case 0x0E: // SET 3, (HL)
-				modifyBit(memory[H << 8 | L], 1, 3);
-				PC += 1;
-				break;
-
-			case 0x0F: // SET 3, A
-				modifyBit(A, 1, 3);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0xE0: // Set bits 4 and 5.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // SET 4, B
-				modifyBit(B, 1, 4);
-				PC += 1;
-				break;
-
-			case 0x01: // SET 4, C
-				modifyBit(C, 1, 4);
-				PC += 1;
-				break;
-
-			case 0x02: // SET 4, D
-				modifyBit(D, 1, 4);
-				PC += 1;
-				break;
-
-			case 0x03: // SET 4, E
-				modifyBit(E, 1, 4);
-				PC += 1;
-				break;
-
-			case 0x04: // SET 4, H
-				modifyBit(H, 1, 4);
-				PC += 1;
-				break;
-
-			case 0x05: // SET 4, L
-				modifyBit(L, 1, 4);
-				PC += 1;
-				break;
-
-			case 0x06: // SET 4, (HL)
-				modifyBit(memory[H << 8 | L], 1, 4);
-				PC += 1;
-				break;
-
-			case 0x07: // SET 4, A
-				modifyBit(A, 1, 4);
-				PC += 1;
-				break;
-
-			case 0x08: // SET 5, B
-				modifyBit(B, 1, 5);
-				PC += 1;
-				break;
-
-			case 0x09: // SET 5, C
-				modifyBit(C, 1, 5);
-				PC += 1;
-				break;
-
-			case 0x0A: // SET 5, D
-				modifyBit(D, 1, 5);
-				PC += 1;
-				break;
-
-			case 0x0B: // SET 5, E
-				modifyBit(E, 1, 5);
-				PC += 1;
-				break;
-
-			case 0x0C: // SET 5, H
-				modifyBit(H, 1, 5);
-				PC += 1;
-				break;
-
-			case 0x0D: // SET 5, L
-				modifyBit(L, 1, 5);
-				PC += 1;
-				break;
-
-			case 0x0E: // SET 5, (HL)
-				modifyBit(memory[H << 8 | L], 1, 5);
-				PC += 1;
-				break;
-
-			case 0x0F: // SET 5, A
-				modifyBit(A, 1, 5);
-				PC += 1;
-				break;
-			}
-			break;
-
-		case 0xF0: // Set bits 6 and 7.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // SET 6, B
-				modifyBit(B, 1, 6);
-				PC += 1;
-				break;
-
-			case 0x01: // SET 6, C
-				modifyBit(C, 1, 6);
-				PC += 1;
-				break;
-
-			case 0x02: // SET 6, D
-				modifyBit(D, 1, 6);
-				PC += 1;
-				break;
-
-			case 0x03: // SET 6, E
-				modifyBit(E, 1, 6);
-				PC += 1;
-				break;
-
-			case 0x04: // SET 6, H
-				modifyBit(H, 1, 6);
-				PC += 1;
-				break;
-
-			case 0x05: // SET 6, L
-				modifyBit(L, 1, 6);
-				PC += 1;
-				break;
-
-			case 0x06: // SET 6, (HL)
-				modifyBit(memory[H << 8 | L], 1, 6);
-				PC += 1;
-				break;
-
-			case 0x07: // SET 6, A
-				modifyBit(A, 1, 6);
-				PC += 1;
-				break;
-
-			case 0x08: // SET 7, B
-				modifyBit(B, 1, 7);
-				PC += 1;
-				break;
-
-			case 0x09: // SET 7, C
-				modifyBit(C, 1, 7);
-				PC += 1;
-				break;
-
-			case 0x0A: // SET 7, D
-				modifyBit(D, 1, 7);
-				PC += 1;
-				break;
-
-			case 0x0B: // SET 7, E
-				modifyBit(E, 1, 7);
-				PC += 1;
-				break;
-
-			case 0x0C: // SET 7, H
-				modifyBit(H, 1, 7);
-				PC += 1;
-				break;
-
-			case 0x0D: // SET 7, L
-				modifyBit(L, 1, 7);
-				PC += 1;
-				break;
-
-			case 0x0E: // SET 7, (HL)
-				modifyBit(memory[H << 8 | L], 1, 7);
-				PC += 1;
-				break;
+// Steps the PPU on to its next mode and schedules the mode after that. A visible line spends 20 machine
+// cycles in OAM search (mode 2), 43 in pixel transfer (mode 3) and the remaining 51 of its 114 in HBLANK
+// (mode 0). Lines 144-153 are VBLANK (mode 1).
+void gb::ppuEvent(uint64_t when)
+{
+	switch (memory[STAT] & 0x3)
+	{
+	case 2: // OAM search -> pixel transfer.
+		setPpuMode(3);
+		scheduleEvent(PPU_EVENT, when + 43);
+		break;
+
+	case 3: // Pixel transfer -> HBLANK. The line is now ready to be drawn.
+		setPpuMode(0);
+		lineReady = true;
+		scheduleEvent(PPU_EVENT, when + 51);
+		break;
+
+	case 0: // End of HBLANK: move to the next line.
+	case 1: // End of a VBLANK line.
+		memory[LY] += 1;
+		if (memory[LY] > 153)
+			memory[LY] = 0;
+		startLine(when);
+		break;
+	}
+}
 
-			case 0x0F: // SET 7, A
-				modifyBit(A, 1, 7);
-				PC += 1;
-				break;
-			}
-			break;
-		}
+// Starts the line in LY at the given cycle, updating the coincidence flag and entering OAM search
+// or VBLANK.
+void gb::startLine(uint64_t when)
+{
+	if (memory[LY] == memory[LYC])
+	{
+		modifyBit(memory[STAT], 1, 2);
+		if ((memory[STAT] >> 6) & 0x1)
+			requestInterrupt(1);	// STAT interrupt.
 	}
+	else
+		modifyBit(memory[STAT], 0, 2);
 
-	else // Some instructions are not prefixed.
+	if (memory[LY] < 144)
 	{
-		// Print out the opcode and other info to the log if logging.
-		if (logging)
+		setPpuMode(2);
+		scheduleEvent(PPU_EVENT, when + 20);
+	}
+	else
+	{
+		// VBLANK starts on line 144 and the finished frame can be shown.
+		if (memory[LY] == 144)
 		{
-			_itoa_s(opcode, opcodeStr, 16);
-			fprintf(pFile,
-				"A: %02X F: %02X B: %02X C: %02X D: %02X E: %02X H: %02X L: %02X SP: %04X PC: 00:%04X (%s %X %X %X)\n",
-				A, F, B, C, D, E, H, L, SP, PC, opcodeStr, memory[PC + 1], memory[PC + 2], memory[PC + 3]);
+			setPpuMode(1);
+			requestInterrupt(0);	// VBLANK interrupt.
+			frameReady = true;
+			if (saveData && saveInterval > 0 && ++framesSinceSave >= saveInterval)
+				flushSave(false);
 		}
-		
-		switch (opcode & 0xF0) 
-		{
-		case 0x00:
-			switch (opcode & 0x0F)
-			{
-			case 0x00: 
-				PC += 1;
-				break;
-
-			case 0x01: // LD BC, d16
-				B = memory[PC + 2];
-				C = memory[PC + 1];
-				PC += 3;
-				break;
-
-			case 0x02: // LD (BC), A
-				writeToMemory((B << 8) | C, A);
-				//memory[(B << 8) | C] = A;
-				PC += 1;
-				break;
-
-			case 0x03: // INC BC
-				BC = combineReg(B, C);
-				INC(BC);
-				splitReg(B, C, BC);
-				PC += 1;
-				break;
-
-			case 0x04: // INC B
-				INC(B);
-				PC += 1;
-				break;
+		scheduleEvent(PPU_EVENT, when + 114);
+	}
+}
 
-			case 0x05: // DEC B
-				DEC(B);
-				PC += 1;
-				break;
+// Sets the mode bits in STAT and requests a STAT interrupt if one is enabled for the new mode.
+void gb::setPpuMode(uint8_t mode)
+{
+	memory[STAT] = (memory[STAT] & 0xFC) | mode;
 
-			case 0x06: // LD B, d8
-				B = memory[PC + 1];
-				PC += 2;
-				break;
+	// STAT bits 3, 4 and 5 enable the interrupt for modes 0, 1 and 2 respectively.
+	if (mode != 3 && ((memory[STAT] >> (3 + mode)) & 0x1))
+		requestInterrupt(1);	// STAT interrupt.
+}
 
-			case 0x07: // RLCA
-				ROT('L', false, A);
-				Zb = 0;
-				PC += 1;
-				break;
+// Works out the half-carry flag from the operands of the last operation that set it.
+bool gb::getH()
+{
+	switch (halfOp)
+	{
+	case HALF_ADD:
+		return halfCarryAdd(halfX, halfY, halfCarryIn);
+	case HALF_SUB:
+		return halfCarrySub(halfX, halfY, halfCarryIn);
+	case HALF_ADD16:
+		return ((halfX & 0xFFF) + (halfY & 0xFFF)) > 0xFFF;
+	default:
+		return halfX;
+	}
+}
 
-			case 0x08: // LD (a16), SP
-				writeToMemory((memory[PC + 2] << 8) | memory[PC + 1], SP & 0xFF);
-				writeToMemory(((memory[PC + 2] << 8) | memory[PC + 1]) + 1, SP >> 8);
-				PC += 3;
-				break;
+// Builds F from the current flag values. Only needed when F is observed (PUSH AF and the log).
+uint8_t gb::getF()
+{
+	return ((zeroResult == 0) << 7) | (Nb << 6) | (getH() << 5) | (Cb << 4);
+}
 
-			case 0x09: // ADD HL, BC
-				HL = combineReg(H, L);
-				BC = combineReg(B, C);
-				ADD(HL, BC);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+// Sets every flag from a value of F, e.g. for POP AF.
+void gb::setF(uint8_t val)
+{
+	F = val & 0xF0;
+	zeroResult = !((val >> 7) & 0x1);
+	Nb = (val >> 6) & 0x1;
+	setHalfCarry(HALF_SET, (val >> 5) & 0x1, 0, 0);
+	Cb = (val >> 4) & 0x1;
+}
 
-			case 0x0A: // LD A, (BC)
-				A = memory[(B << 8) | C];
-				PC += 1;
-				break;
+// Records the operands of an operation so the half-carry flag can be worked out later if needed.
+void gb::setHalfCarry(uint8_t op, uint16_t x, uint16_t y, uint8_t carryIn)
+{
+	halfOp = op;
+	halfX = x;
+	halfY = y;
+	halfCarryIn = carryIn;
+}
 
-			case 0x0B: // DEC BC
-				BC = combineReg(B, C);
-				DEC(BC);
-				splitReg(B, C, BC);
-				PC += 1;
-				break;
+// Set or reset a bit in a byte, at a given position.
+void gb::modifyBit(uint8_t &val, int bitVal, int pos)
+{
+	// Bit masks are used to modify the value of the bit.
+	if (bitVal == 0)
+	{
+		val &= ~(0x1 << pos);
+	}
+	else if (bitVal == 1)
+	{
+		val |= 0x1 << pos;
+	}
+}
 
-			case 0x0C: // INC C
-				INC(C);
-				PC += 1;
-				break;
+// Works out where reads and writes to a page of the address space go. ROM and cartridge RAM pages point
+// into the banks the MBC has selected. Echo RAM (E000-FDFF) is the same memory as C000-DDFF. Writes to
+// ROM, to the page holding OAM, to I/O and to watched pages have to go through writeIO(). Reads of the
+// page holding I/O go through readIO(), as some registers are only worked out when they are read.
+// While OAM DMA runs, the pages it cuts the CPU off from have no pointers at all.
+void gb::mapPage(int page)
+{
+	if (dmaActive && isDmaBusPage(page))
+	{
+		readPages[page] = nullptr;
+		writePages[page] = nullptr;
+		return;
+	}
+	if (page < 0x80)
+	{
+		readPages[page] = rom + romWindowBank[page >> 6] * 0x4000 + ((page & 0x3F) << 8);
+		writePages[page] = nullptr;
+		return;
+	}
+	if (page >= 0xA0 && page < 0xC0)
+	{
+		readPages[page] = cartRamWindow ? cartRamWindow + ((page - 0xA0) << 8) : rtcRegister >= 0 ? rtcPage : unmappedPage;
+		writePages[page] = cartRamWindow && !pageWatches[page] ? cartRamWindow + ((page - 0xA0) << 8) : nullptr;
+		return;
+	}
 
-			case 0x0D: // DEC C
-				DEC(C);
-				PC += 1;
-				break;
+	int target = (page >= 0xE0 && page < 0xFE) ? page - 0x20 : page;
+	readPages[page] = page < 0xFF ? &memory[target << 8] : nullptr;
+	writePages[page] = (page >= 0x80 && page < 0xFE && !pageWatches[target]) ? &memory[target << 8] : nullptr;
+}
 
-			case 0x0E: // LD C, d8
-				C = memory[PC + 1];
-				PC += 2;
-				break;
+// Sets up the whole memory map.
+void gb::mapMemory()
+{
+	for (int page = 0; page < 0x100; page++)
+		mapPage(page);
+}
 
-			case 0X0F: // RRCA
-				ROT('R', false, A);
-				Zb = 0;
-				PC += 1;
-				break;
-			}
-			break;
+// Starts or stops watching writes to a page for one reason (a pageWatch). A watched page, and its echo,
+// have no write pointer, so only their writes pay for the check in writeIO().
+void gb::setPageWatch(uint8_t page, uint8_t reason, bool set)
+{
+	if (set)
+		pageWatches[page] |= reason;
+	else
+		pageWatches[page] &= ~reason;
+	mapPage(page);
+	if (page >= 0xC0 && page < 0xDE)
+		mapPage(page + 0x20);
+}
 
-		case 0x10: // Need to update STOP to do something.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // STOP
-				printf("??");
-				PC += 1;
-				break;
+// Handles a write to a watched page. Compiled blocks starting in the page may no longer match memory,
+// so they are dropped. Page FF is mostly I/O, so only writes to its high RAM can change code there. A
+// write to a watchpoint makes runUntil() stop after the instruction.
+void gb::checkWatchedWrite(uint16_t addr)
+{
+	uint8_t page = addr >> 8;
+	if ((pageWatches[page] & WATCH_CODE) && (page != 0xFF || (addr >= 0xFF80 && addr < 0xFFFF)))
+		invalidateJitPage(page);
+	if ((pageWatches[page] & WATCH_DATA) && ((watchBits[addr >> 3] >> (addr & 0x7)) & 0x1))
+	{
+		watchHit = true;
+		watchAddress = addr;
+		jitExit = true;
+	}
+}
 
-			case 0x01: // LD DE, d16
-				D = memory[PC + 2];
-				E = memory[PC + 1];
-				PC += 3;
-				break;
+// Reads a byte the way the CPU sees it.
+uint8_t gb::readMemory(uint16_t addr)
+{
+	const uint8_t* page = readPages[addr >> 8];
+	return page ? page[addr & 0xFF] : readIO(addr);
+}
 
-			case 0x02: // LD (DE), A
-				writeToMemory((D << 8) | E, A);
-				PC += 1;
-				break;
+// Reads the opcode at PC into opcode and the two bytes after it into imm16. Unless the instruction is
+// in I/O or runs into the next page, all three come from one page.
+inline void gb::fetchInstruction()
+{
+	const uint8_t* page = readPages[PC >> 8];
+	uint8_t offset = PC & 0xFF;
+	if (page && offset < 0xFE)
+	{
+		opcode = page[offset];
+		imm16 = (page[offset + 2] << 8) | page[offset + 1];
+	}
+	else
+	{
+		opcode = readMemory(PC);
+		imm16 = (readMemory(PC + 2) << 8) | readMemory(PC + 1);
+	}
+}
 
-			case 0x03: // INC DE
-				DE = combineReg(D, E);
-				INC(DE);
-				splitReg(D, E, DE);
-				PC += 1;
-				break;
+// Reads from a page without a host pointer. DIV, TIMA and JOYP aren't kept up to date in memory, and
+// are worked out as they are read. A polling loop can't be skipped if it reads DIV or TIMA, as those
+// change without an event.
+uint8_t gb::readIO(uint16_t addr)
+{
+	if (dmaActive && isDmaBusPage(addr >> 8))
+		return 0xFF;
 
-			case 0x04: // INC D
-				INC(D);
-				PC += 1;
-				break;
+	switch (addr)
+	{
+	case JOYP:
+		return readJoypad();
+	case DIV:	// The upper 8 bits of a counter that goes up every machine cycle.
+		idleLoop.valid = false;
+		return static_cast<uint8_t>((counter - divReset) >> 6);
+	case TIMA:
+		idleLoop.valid = false;
+		updateTima();
+		return memory[TIMA];
+	default:
+		return memory[addr];
+	}
+}
 
-			case 0x05: // DEC D
-				DEC(D);
-				PC += 1;
-				break;
+// Checks if a page is cut off from the CPU by a running OAM DMA. The transfer uses OAM and either the
+// video bus (VRAM) or the external bus (everything else below FE00), depending on its source. I/O and
+// high RAM are always reachable, which is why games run their DMA routine from high RAM.
+bool gb::isDmaBusPage(int page)
+{
+	if (page >= 0xFF)
+		return false;
+	if (page == 0xFE)
+		return true;
+	bool videoBus = page >= 0x80 && page < 0xA0;
+	return videoBus == (dmaSource >= 0x80 && dmaSource < 0xA0);
+}
 
-			case 0x06: // LD D, d8
-				D = memory[PC + 1];
-				PC += 2;
-				break;
+// Used to control memory writes by instructions in the CPU's instruction set. Pages of RAM have a host
+// pointer in writePages (see mapPage()), so most writes are a lookup and a store. ROM, OAM, I/O,
+// watched pages and pages cut off by OAM DMA have none, and their writes go through writeIO(). The
+// core's own updates don't come through here, e.g. input arrives through setJoypad() and JOYP is
+// worked out from it when read.
+void gb::writeToMemory(uint16_t addr, uint8_t data)
+{
+	uint8_t* page = writePages[addr >> 8];
+	if (page)
+	{
+		page[addr & 0xFF] = data;
+		idleLoop.valid = false;
+		return;
+	}
+	writeIO(addr, data);
+}
 
-			case 0x07: // RLA
-				ROT('L', true, A);
-				Zb = 0;
-				PC += 1;
-				break;
+// Writes to a page without a host pointer.
+void gb::writeIO(uint16_t addr, uint8_t data)
+{
+	idleLoop.valid = false;
+	if (dmaActive && isDmaBusPage(addr >> 8))
+		return;
+	if (addr >= 0xE000 && addr < 0xFE00)	// Echo RAM
+		addr -= 0x2000;
+	if (pageWatches[addr >> 8])
+		checkWatchedWrite(addr);
+
+	// Writes to ROM go to the MBC. A bank switch can change the code a running block was compiled from.
+	// Cartridge RAM only gets here if it isn't mapped, its page is watched or an MBC3 clock register is
+	// selected in its place.
+	if (addr < 0x8000)
+	{
+		writeMbc(addr, data);
+		jitExit = true;
+		return;
+	}
+	if (addr >= 0xA000 && addr < 0xC000)
+	{
+		if (cartRamWindow)
+			cartRamWindow[addr - 0xA000] = data;
+		else if (rtcRegister >= 0)
+			writeRtc(rtcRegister, data);
+		return;
+	}
 
-			case 0x08: // JR r8
-			{
-				int8_t offset;
-				PC += 1;
-				offset = memory[PC];
-				PC += offset;
-				PC += 1;
-				break;
-			}
-			case 0x09: // ADD HL, DE
-				HL = combineReg(H, L);
-				DE = combineReg(D, E);
-				ADD(HL, DE);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+	// I/O writes can raise interrupts or change events, so they make a running JIT block return.
+	if (addr >= 0xFF00 && (addr < 0xFF80 || addr == 0xFFFF))
+		jitExit = true;
 
-			case 0x0A: // LD A, (DE)
-				A = memory[(D << 8) | E];
-				PC += 1;
-				break;
+	if (addr < 0xFEA0 || (addr >= 0xFF80 && addr < 0xFFFF))	// RAM, OAM and high RAM
+	{
+		memory[addr] = data;
+	}
+	else if (addr < 0xFF00)	// Unused range
+	{
+		printf("Game tried to write to unusable range! addr = %X, data = %X\n", addr, data);
+	}
+	else if (addr == 0xFF00)  // JOYP
+	{
+		modifyBit(memory[addr], (data >> 4) & 0x1, 4);
+		modifyBit(memory[addr], (data >> 5) & 0x1, 5);
+	}
+	else if (addr == 0xFF02)			// Serial transfer control
+	{
+		memory[addr] = data | 0x7E;
 
-			case 0x0B: // DEC DE
-				DE = combineReg(D, E);
-				DEC(DE);
-				splitReg(D, E, DE);
-				PC += 1;
-				break;
+		// A transfer using the internal clock shifts out 8 bits at 8192Hz, i.e. 128 machine cycles per bit.
+		if ((data & 0x81) == 0x81)
+			scheduleEvent(SERIAL_EVENT, counter + 8 * 128);
+		else
+			cancelEvent(SERIAL_EVENT);
+	}
+	else if (addr == 0xFF04)			// DIV register
+	{
+		divReset = counter;
+	}
+	else if (addr == 0xFF05)			// TIMA register
+	{
+		updateTima();
+		memory[addr] = data;
+		updateTimerEvent();
+	}
+	else if (addr == 0xFF07)			// TAC register, TIMA counts at the old rate up to now
+	{
+		updateTima();
+		memory[addr] = data & 0x7;
+		updateTimerEvent();
+	}
+	else if (addr == 0xFF40)			// LCDC register
+	{
+		bool wasOn = (memory[addr] >> 7) & 0x1;
+		memory[addr] = data;
 
-			case 0x0C: // INC E
-				INC(E);
-				PC += 1;
-				break;
+		// Turning the LCD off resets the PPU to the top of the screen; turning it on restarts line 0.
+		if (wasOn && !((data >> 7) & 0x1))
+		{
+			cancelEvent(PPU_EVENT);
+			memory[LY] = 0;
+			memory[STAT] &= 0xFC;
+		}
+		else if (!wasOn && ((data >> 7) & 0x1))
+			startLine(counter);
+	}
+	else if (addr == 0xFF41)			// STAT register (mode and coincidence bits are read-only)
+	{
+		memory[addr] = (data & 0x78) | (memory[addr] & 0x07);
+	}
+	else if (addr == 0xFF44)			// LY is read-only
+	{
+		return;
+	}
+	else if (addr == IF || addr == IE)	// Interrupt flags and enable
+	{
+		memory[addr] = data;
+		updateInterrupts();
+	}
+	else if (addr == 0xFF46)			// DMA transfer, copied into OAM when it completes 160 cycles later
+	{
+		// Sources from E0 up are read from work RAM, as echo RAM is.
+		memory[0xFF46] = data;
+		dmaSource = data >= 0xE0 ? data - 0x20 : data;
+		dmaActive = true;
+		mapMemory();
+		scheduleEvent(DMA_EVENT, counter + 160);
+	}
+	else								// Unconditional transfer
+		memory[addr] = data;
+}
 
-			case 0x0D: // DEC E
-				DEC(E);
-				PC += 1;
-				break;
+// Increment a byte.
+void gb::INC(uint8_t &val)
+{
+	setHalfCarry(HALF_ADD, val, 0x1, 0);
+	val += 1;
+	zeroResult = val;
+	Nb = 0;
+}
 
-			case 0x0E: // LD E, d8
-				E = memory[PC + 1];
-				PC += 2;
-				break;
+// Increment a 16-bit value.
+void gb::INC(uint16_t &val)
+{
+	val += 1;
+}
 
-			case 0x0F: // RRA
-				ROT('R', true, A);
-				Zb = 0;
-				PC += 1;
-				break;
-			}
-			break;
+// Decrement a byte.
+void gb::DEC(uint8_t &val)
+{
+	setHalfCarry(HALF_SUB, val, 0x1, 0);
+	val -= 1;
+	zeroResult = val;
+	Nb = 1;
+}
 
-		case 0x20:
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // JR NZ, r8
-				if (Zb == 0)
-				{
-					int8_t offset;
-					PC += 1;
-					offset = memory[PC];
-					PC += offset;
-					PC += 1;
-				}
-				else
-					PC += 2;
-				break;
+// Decrement a 16-bit value.
+void gb::DEC(uint16_t &val)
+{
+	val -= 1;
+}
 
-			case 0x01: // LD HL, d16
-				H = memory[PC + 2];
-				L = memory[PC + 1];
-				PC += 3;
-				break;
+// Adds a byte value to another byte, with or without adding the carry bit. The sum is worked out in 16
+// bits so the carry out is bit 8, without branching.
+void gb::ADD(uint8_t &val1, uint8_t val2, bool carry)
+{
+	uint8_t carryIn = carry & Cb;
+	uint16_t sum = addBytes(val1, val2, carryIn);
+	setHalfCarry(HALF_ADD, val1, val2, carryIn);
+	val1 = sum & 0xFF;
+	Cb = sum >> 8;
+	zeroResult = val1;
+	Nb = 0;
+}
 
-			case 0x02: // LD (HL+), A
-				writeToMemory((H << 8) | L, A);
-				HL = combineReg(H, L);
-				INC(HL);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+// Adds a 16-bit value to another 16-bit value.
+void gb::ADD(uint16_t &val1, uint16_t val2)
+{
+	uint32_t sum = val1 + val2;
+	setHalfCarry(HALF_ADD16, val1, val2, 0);
+	val1 = sum & 0xFFFF;
+	Cb = sum >> 16;
+	Nb = 0;
+}
 
-			case 0x03: // INC HL
-				HL = combineReg(H, L);
-				INC(HL);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+// Adds a signed 8-bit value to an unsigned 16-bit value.
+void gb::ADD(uint16_t &val1, int8_t val2)
+{
+	Cb = ((val1 & 0xFF) + (val2 & 0xFF)) >> 8;
+	setHalfCarry(HALF_ADD, val1 & 0xFF, val2 & 0xFF, 0);
 
-			case 0x04: // INC H
-				INC(H);
-				PC += 1;
-				break;
+	val1 += val2;
+	Nb = 0;
+	zeroResult = 1;
+}
 
-			case 0x05: // DEC H
-				DEC(H);
-				PC += 1;
-				break;
+// Subtract an 8-bit value from A, along with the carry bit if required. A borrow shows up in bit 8 of
+// the 16-bit difference.
+void gb::SUB(uint8_t val, bool carry)
+{
+	uint8_t carryIn = carry & Cb;
+	uint16_t diff = subBytes(A, val, carryIn);
+	setHalfCarry(HALF_SUB, A, val, carryIn);
+	A = diff & 0xFF;
+	Cb = diff >> 8;
+	zeroResult = A;
+	Nb = 1;
+}
 
-			case 0x06: // LD H, d8
-				H = memory[PC + 1];
-				PC += 2;
-				break;
+// ANDs A with a value.
+void gb::AND(uint8_t val)
+{
+	A &= val;
+	zeroResult = A;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 1, 0, 0);
+	Cb = 0;
+}
 
-			case 0x07: // DAA
-			{
-				if (Nb == 0)
-				{
-					if (A > 0x99 || Cb == 1)
-					{
-						A += 0x60;
-						Cb = 1;
-						
-					}
-					if (((A & 0xF) > 0x9) || Hb == 1)
-						A += 0x6;
-				}
-				else
-				{
-					if (Cb == 1)
-					{
-						A -= 0x60;
-						Cb = 1;
-					}
-						
-					if (Hb == 1)
-						A -= 0x6;
-				}
-
-				Zb = checkZero(A);
-				Hb = 0;
-				PC += 1;
-				break;
-			}
+// XORs A with a value.
+void gb::XOR(uint8_t val)
+{
+	A ^= val;
+	zeroResult = A;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+	Cb = 0;
+}
 
-			case 0x08: // JR Z, r8
-				if (Zb == 1)
-				{
-					int8_t offset;
-					PC += 1;
-					offset = memory[PC];
-					PC += offset;
-					PC += 1;
-				}
-				else
-					PC += 2;
-				break;
+// ORs A with a value.
+void gb::OR(uint8_t val)
+{
+	A |= val;
+	zeroResult = A;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+	Cb = 0;
+}
 
-			case 0x09: // ADD HL, HL
-				HL = combineReg(H, L);
-				ADD(HL, HL);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+// Sets the flags for a subtraction of an 8-bit value from A, without storing the result.
+void gb::CP(uint8_t val)
+{
+	uint16_t diff = subBytes(A, val, 0);
+	setHalfCarry(HALF_SUB, A, val, 0);
+	zeroResult = diff & 0xFF;
+	Cb = diff >> 8;
+	Nb = 1;
+}
 
-			case 0x0A: // LD A, (HL+)
-				A = memory[(H << 8) | L];
-				HL = combineReg(H, L);
-				INC(HL);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+// Rotate a byte left, moving bit 7 into the carry and bit 0.
+void gb::RLC(uint8_t &val)
+{
+	Cb = val >> 7;
+	val = (val << 1) | Cb;
+	zeroResult = val;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+}
 
-			case 0x0B: // DEC HL
-				HL = combineReg(H, L);
-				DEC(HL);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+// Rotate a byte right, moving bit 0 into the carry and bit 7.
+void gb::RRC(uint8_t &val)
+{
+	Cb = val & 0x1;
+	val = (val >> 1) | (Cb << 7);
+	zeroResult = val;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+}
 
-			case 0x0C: // INC L
-				INC(L);
-				PC += 1;
-				break;
+// Rotate a byte left through the carry.
+void gb::RL(uint8_t &val)
+{
+	uint8_t oldCb = Cb;
+	Cb = val >> 7;
+	val = (val << 1) | oldCb;
+	zeroResult = val;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+}
 
-			case 0x0D: // DEC L
-				DEC(L);
-				PC += 1;
-				break;
+// Rotate a byte right through the carry.
+void gb::RR(uint8_t &val)
+{
+	uint8_t oldCb = Cb;
+	Cb = val & 0x1;
+	val = (val >> 1) | (oldCb << 7);
+	zeroResult = val;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+}
 
-			case 0x0E: // LD L, d8
-				L = memory[PC + 1];
-				PC += 2;
-				break;
+// Shift a byte left into the carry.
+void gb::SLA(uint8_t &val)
+{
+	Cb = val >> 7;
+	val <<= 1;
+	zeroResult = val;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+}
 
-			case 0x0F: // CPL
-				A = ~A;
-				Nb = 1;
-				Hb = 1;
-				PC += 1;
-				break;
-			}
-			break;
+// Shift a byte right into the carry, keeping bit 7 so the sign is retained.
+void gb::SRA(uint8_t &val)
+{
+	Cb = val & 0x1;
+	val = (val >> 1) | (val & 0x80);
+	zeroResult = val;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+}
 
-		case 0x30:
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // JR NC, r8
-				if (Cb == 0)
-				{
-					int8_t offset;
-					PC += 1;
-					offset = memory[PC];
-					PC += offset;
-					PC += 1;
-				}
-				else
-					PC += 2;
-				break;
+// Shift a byte right logically into the carry.
+void gb::SRL(uint8_t &val)
+{
+	Cb = val & 0x1;
+	val >>= 1;
+	zeroResult = val;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+}
 
-			case 0x01: // LD SP, d16
-				SP = (memory[PC + 2] << 8) | memory[PC + 1];
-				PC += 3;
-				break;
+// Checks the value of a given bit in a byte, and sets the zero flag if it is zero.
+void gb::BIT(int pos, uint8_t r)
+{
+	zeroResult = (r >> pos) & 0x1;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 1, 0, 0);
+}
 
-			case 0x02: // LD (HL-), A
-				writeToMemory((H << 8) | L, A);
-				HL = combineReg(H, L);
-				DEC(HL);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+// Swaps the upper and lower nibbles of a byte.
+void gb::SWAP(uint8_t &val)
+{
+	val = val << 4 | val >> 4;
+	zeroResult = val;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+	Cb = 0;
+}
 
-			case 0x03: // INC SP
-				INC(SP);
-				PC += 1;
-				break;
+// Calls the next address in memory.
+void gb::CALL()
+{
+	// Push the next instruction onto the stack.
+	writeToMemory(SP - 1, (PC + 3) >> 8);
+	writeToMemory(SP - 2, (PC + 3) & 0xFF);
+	SP -= 2;
 
-			case 0x04: // INC (HL)
-				INC(memory[(H << 8) | L]);
-				PC += 1;
-				break;
+	// Jump to the address.
+	PC = imm16;
+}
 
-			case 0x05: // DEC (HL)
-				DEC(memory[(H << 8) | L]);
-				PC += 1;
-				break;
+// Calls the given address.
+void gb::RST(uint8_t vec)
+{
+	PC += 1;
+	writeToMemory(SP - 1, PC >> 8);
+	writeToMemory(SP - 2, PC & 0xFF);
+	SP -= 2;
+	PC = vec;
+}
 
-			case 0x06: // LD (HL), d8
-				writeToMemory((H << 8) | L, memory[PC + 1]);
-				PC += 2;
-				break;
+// Enable interrupts.
+void gb::EI()
+{
+	IME = true;
+	scheduleIME = false;
+	cyclesBeforeEnableIME = 1;
+	updateInterrupts();
+}
 
-			case 0x07: // SCF
-				Cb = 1;
-				Nb = 0;
-				Hb = 0;
-				PC += 1;
-				break;
+// Disable interrupts.
+void gb::DI()	
+{
+	IME = false;
+	scheduleIME = false;
+	cyclesBeforeEnableIME = 1;
+	interruptPending = false;
+}
 
-			case 0x08: // JR C, r8
-				if (Cb == 1)
-				{
-					int8_t offset;
-					PC += 1;
-					offset = memory[PC];
-					PC += offset;
-					PC += 1;
-				}
-				else
-					PC += 2;
-				break;
+// Dispatch tables mapping each opcode to its handler. cbTable is indexed by the byte after a CB prefix.
+const gb::opHandler gb::opTable[256] =
+{
+	&gb::op00, &gb::op01, &gb::op02, &gb::op03, &gb::op04, &gb::op05, &gb::op06, &gb::op07, &gb::op08, &gb::op09, &gb::op0A, &gb::op0B, &gb::op0C, &gb::op0D, &gb::op0E, &gb::op0F,
+	&gb::op10, &gb::op11, &gb::op12, &gb::op13, &gb::op14, &gb::op15, &gb::op16, &gb::op17, &gb::op18, &gb::op19, &gb::op1A, &gb::op1B, &gb::op1C, &gb::op1D, &gb::op1E, &gb::op1F,
+	&gb::op20, &gb::op21, &gb::op22, &gb::op23, &gb::op24, &gb::op25, &gb::op26, &gb::op27, &gb::op28, &gb::op29, &gb::op2A, &gb::op2B, &gb::op2C, &gb::op2D, &gb::op2E, &gb::op2F,
+	&gb::op30, &gb::op31, &gb::op32, &gb::op33, &gb::op34, &gb::op35, &gb::op36, &gb::op37, &gb::op38, &gb::op39, &gb::op3A, &gb::op3B, &gb::op3C, &gb::op3D, &gb::op3E, &gb::op3F,
+	&gb::op40, &gb::op41, &gb::op42, &gb::op43, &gb::op44, &gb::op45, &gb::op46, &gb::op47, &gb::op48, &gb::op49, &gb::op4A, &gb::op4B, &gb::op4C, &gb::op4D, &gb::op4E, &gb::op4F,
+	&gb::op50, &gb::op51, &gb::op52, &gb::op53, &gb::op54, &gb::op55, &gb::op56, &gb::op57, &gb::op58, &gb::op59, &gb::op5A, &gb::op5B, &gb::op5C, &gb::op5D, &gb::op5E, &gb::op5F,
+	&gb::op60, &gb::op61, &gb::op62, &gb::op63, &gb::op64, &gb::op65, &gb::op66, &gb::op67, &gb::op68, &gb::op69, &gb::op6A, &gb::op6B, &gb::op6C, &gb::op6D, &gb::op6E, &gb::op6F,
+	&gb::op70, &gb::op71, &gb::op72, &gb::op73, &gb::op74, &gb::op75, &gb::op76, &gb::op77, &gb::op78, &gb::op79, &gb::op7A, &gb::op7B, &gb::op7C, &gb::op7D, &gb::op7E, &gb::op7F,
+	&gb::op80, &gb::op81, &gb::op82, &gb::op83, &gb::op84, &gb::op85, &gb::op86, &gb::op87, &gb::op88, &gb::op89, &gb::op8A, &gb::op8B, &gb::op8C, &gb::op8D, &gb::op8E, &gb::op8F,
+	&gb::op90, &gb::op91, &gb::op92, &gb::op93, &gb::op94, &gb::op95, &gb::op96, &gb::op97, &gb::op98, &gb::op99, &gb::op9A, &gb::op9B, &gb::op9C, &gb::op9D, &gb::op9E, &gb::op9F,
+	&gb::opA0, &gb::opA1, &gb::opA2, &gb::opA3, &gb::opA4, &gb::opA5, &gb::opA6, &gb::opA7, &gb::opA8, &gb::opA9, &gb::opAA, &gb::opAB, &gb::opAC, &gb::opAD, &gb::opAE, &gb::opAF,
+	&gb::opB0, &gb::opB1, &gb::opB2, &gb::opB3, &gb::opB4, &gb::opB5, &gb::opB6, &gb::opB7, &gb::opB8, &gb::opB9, &gb::opBA, &gb::opBB, &gb::opBC, &gb::opBD, &gb::opBE, &gb::opBF,
+	&gb::opC0, &gb::opC1, &gb::opC2, &gb::opC3, &gb::opC4, &gb::opC5, &gb::opC6, &gb::opC7, &gb::opC8, &gb::opC9, &gb::opCA, &gb::opCB, &gb::opCC, &gb::opCD, &gb::opCE, &gb::opCF,
+	&gb::opD0, &gb::opD1, &gb::opD2, &gb::opD3, &gb::opD4, &gb::opD5, &gb::opD6, &gb::opD7, &gb::opD8, &gb::opD9, &gb::opDA, &gb::opDB, &gb::opDC, &gb::opDD, &gb::opDE, &gb::opDF,
+	&gb::opE0, &gb::opE1, &gb::opE2, &gb::opE3, &gb::opE4, &gb::opE5, &gb::opE6, &gb::opE7, &gb::opE8, &gb::opE9, &gb::opEA, &gb::opEB, &gb::opEC, &gb::opED, &gb::opEE, &gb::opEF,
+	&gb::opF0, &gb::opF1, &gb::opF2, &gb::opF3, &gb::opF4, &gb::opF5, &gb::opF6, &gb::opF7, &gb::opF8, &gb::opF9, &gb::opFA, &gb::opFB, &gb::opFC, &gb::opFD, &gb::opFE, &gb::opFF
+};
+
+// Returns one of the registers a CB-prefixed instruction can operate on, numbered as in its opcode.
+// (HL) is handled by the caller.
+uint8_t& gb::cbRegister(int r)
+{
+	switch (r)
+	{
+	case 0: return B;
+	case 1: return C;
+	case 2: return D;
+	case 3: return E;
+	case 4: return H;
+	case 5: return L;
+	default: return A;
+	}
+}
 
-			case 0x09: // ADD HL, SP
-				HL = combineReg(H, L);
-				ADD(HL, SP);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+// Runs a CB-prefixed instruction. Bits 6-7 of the opcode pick rotates and shifts, BIT, RES or SET, bits
+// 3-5 pick the rotate or shift, or the bit, and bits 0-2 pick the operand: B, C, D, E, H, L, (HL) or A.
+// All three come from the template argument, so the compiler folds every condition below and each of
+// the 256 instantiations only does its own work.
+template <int N>
+void gb::cbOp()
+{
+	const int group = N >> 6;
+	const int bit = (N >> 3) & 0x7;
+	const int operand = N & 0x7;
+	uint8_t val = operand == 6 ? readMemory(HL) : cbRegister(operand);
 
-			case 0x0A: // LD A, (HL-)
-				A = memory[(H << 8) | L];
-				HL = combineReg(H, L);
-				DEC(HL);
-				splitReg(H, L, HL);
-				PC += 1;
-				break;
+	switch (group)
+	{
+	case 0:
+		switch (bit)
+		{
+		case 0: RLC(val); break;
+		case 1: RRC(val); break;
+		case 2: RL(val); break;
+		case 3: RR(val); break;
+		case 4: SLA(val); break;
+		case 5: SRA(val); break;
+		case 6: SWAP(val); break;
+		case 7: SRL(val); break;
+		}
+		break;
+	case 1:
+		BIT(bit, val);
+		break;
+	case 2:
+		val &= ~(1 << bit);
+		break;
+	case 3:
+		val |= 1 << bit;
+		break;
+	}
 
-			case 0x0B: // DEC SP
-				DEC(SP);
-				PC += 1;
-				break;
+	// BIT only reads its operand.
+	if (group != 1)
+	{
+		if (operand == 6)
+			writeToMemory(HL, val);
+		else
+			cbRegister(operand) = val;
+	}
+	PC += 1;
+}
 
-			case 0x0C: // INC A
-				INC(A);
-				PC += 1;
-				break;
+#define CB_OPS(h) \
+	&gb::cbOp<h + 0x0>, &gb::cbOp<h + 0x1>, &gb::cbOp<h + 0x2>, &gb::cbOp<h + 0x3>, \
+	&gb::cbOp<h + 0x4>, &gb::cbOp<h + 0x5>, &gb::cbOp<h + 0x6>, &gb::cbOp<h + 0x7>, \
+	&gb::cbOp<h + 0x8>, &gb::cbOp<h + 0x9>, &gb::cbOp<h + 0xA>, &gb::cbOp<h + 0xB>, \
+	&gb::cbOp<h + 0xC>, &gb::cbOp<h + 0xD>, &gb::cbOp<h + 0xE>, &gb::cbOp<h + 0xF>
 
-			case 0x0D: // DEC A
-				DEC(A);
-				PC += 1;
-				break;
+const gb::opHandler gb::cbTable[256] =
+{
+	CB_OPS(0x00),
+	CB_OPS(0x10),
+	CB_OPS(0x20),
+	CB_OPS(0x30),
+	CB_OPS(0x40),
+	CB_OPS(0x50),
+	CB_OPS(0x60),
+	CB_OPS(0x70),
+	CB_OPS(0x80),
+	CB_OPS(0x90),
+	CB_OPS(0xA0),
+	CB_OPS(0xB0),
+	CB_OPS(0xC0),
+	CB_OPS(0xD0),
+	CB_OPS(0xE0),
+	CB_OPS(0xF0)
+};
+
+#undef CB_OPS
+
+// Machine cycles taken by each instruction. Conditional jumps, calls and returns are listed with their
+// not-taken cost; the handlers add the extra cycles when the branch is taken.
+const uint8_t gb::opCycles[256] =
+{
+	1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
+	1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+	2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+	2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 3, 4, 3, 4, 2, 4, 2, 4, 3, 1, 3, 6, 2, 4,
+	2, 3, 3, 1, 3, 4, 2, 4, 2, 4, 3, 1, 3, 1, 2, 4,
+	3, 3, 2, 1, 1, 4, 2, 4, 4, 1, 4, 1, 1, 1, 2, 4,
+	3, 3, 2, 1, 1, 4, 2, 4, 3, 2, 4, 1, 1, 1, 2, 4
+};
+
+// Machine cycles taken by each CB-prefixed instruction, including the prefix byte.
+const uint8_t gb::cbCycles[256] =
+{
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 3, 2, 2, 2, 2, 2, 2, 2, 3, 2,
+	2, 2, 2, 2, 2, 2, 3, 2, 2, 2, 2, 2, 2, 2, 3, 2,
+	2, 2, 2, 2, 2, 2, 3, 2, 2, 2, 2, 2, 2, 2, 3, 2,
+	2, 2, 2, 2, 2, 2, 3, 2, 2, 2, 2, 2, 2, 2, 3, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,
+	2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2
+};
+
+// Length in bytes of each instruction, including operands. The CB prefix counts as part of a 2-byte instruction.
+const uint8_t gb::opLengths[256] =
+{
+	1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+	1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1
+};
+
+// NOP
+void gb::op00()
+{
+	PC += 1;
+}
 
-			case 0x0E: // LD A, d8
-				A = memory[PC + 1];
-				PC += 2;
-				break;
+// LD BC, d16
+void gb::op01()
+{
+	BC = imm16;
+	PC += 3;
+}
 
-			case 0x0F: // CCF
-				if (Cb == 0)
-					Cb = 1;
-				else
-					Cb = 0;
-				Nb = 0;
-				Hb = 0;
-				PC += 1;
-				break;
-			}
-			break;
+// LD (BC), A
+void gb::op02()
+{
+	writeToMemory(BC, A);
+	//memory[BC] = A;
+	PC += 1;
+}
 
-		case 0x40: // Loads into B and C.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // LD B, B
-				B = B;
-				PC += 1;
-				break;
+// INC BC
+void gb::op03()
+{
+	INC(BC);
+	PC += 1;
+}
 
-			case 0x01: // LD B, C
-				B = C;
-				PC += 1;
-				break;
+// INC B
+void gb::op04()
+{
+	INC(B);
+	PC += 1;
+}
 
-			case 0x02: // LD B, D
-				B = D;
-				PC += 1;
-				break;
+// DEC B
+void gb::op05()
+{
+	DEC(B);
+	PC += 1;
+}
 
-			case 0x03: // LD B, E
-				B = E;
-				PC += 1;
-				break;
+// LD B, d8
+void gb::op06()
+{
+	B = imm8;
+	PC += 2;
+}
 
-			case 0x04: // LD B, H
-				B = H;
-				PC += 1;
-				break;
+// RLCA
+void gb::op07()
+{
+	RLC(A);
+	zeroResult = 1;
+	PC += 1;
+}
 
-			case 0x05: // LD B, L
-				B = L;
-				PC += 1;
-				break;
+// LD (a16), SP
+void gb::op08()
+{
+	writeToMemory(imm16, SP & 0xFF);
+	writeToMemory(imm16 + 1, SP >> 8);
+	PC += 3;
+}
 
-			case 0x06: // LD B, (HL)
-				B = memory[(H << 8) | L];
-				PC += 1;
-				break;
+// ADD HL, BC
+void gb::op09()
+{
+	ADD(HL, BC);
+	PC += 1;
+}
 
-			case 0x07: // LD B, A
-				B = A;
-				PC += 1;
-				break;
+// LD A, (BC)
+void gb::op0A()
+{
+	A = readMemory(BC);
+	PC += 1;
+}
 
-			case 0x08: // LD C, B
-				C = B;
-				PC += 1;
-				break;
+// DEC BC
+void gb::op0B()
+{
+	DEC(BC);
+	PC += 1;
+}
 
-			case 0x09: // LD C, C
-				C = C;
-				PC += 1;
-				break;
+// INC C
+void gb::op0C()
+{
+	INC(C);
+	PC += 1;
+}
 
-			case 0x0A: // LD C, D
-				C = D;
-				PC += 1;
-				break;
+// DEC C
+void gb::op0D()
+{
+	DEC(C);
+	PC += 1;
+}
 
-			case 0x0B: // LD C, E
-				C = E;
-				PC += 1;
-				break;
+// LD C, d8
+void gb::op0E()
+{
+	C = imm8;
+	PC += 2;
+}
 
-			case 0x0C: // LD C, H
-				C = H;
-				PC += 1;
-				break;
+// RRCA
+void gb::op0F()
+{
+	RRC(A);
+	zeroResult = 1;
+	PC += 1;
+}
 
-			case 0x0D: // LD C, L
-				C = L;
-				PC += 1;
-				break;
+// STOP
+void gb::op10()
+{
+	printf("??");
+	PC += 1;
+}
 
-			case 0x0E: // LD C, (HL)
-				C = memory[(H << 8) | L];
-				PC += 1;
-				break;
+// LD DE, d16
+void gb::op11()
+{
+	DE = imm16;
+	PC += 3;
+}
 
-			case 0x0F: // LD C, A
-				C = A;
-				PC += 1;
-				break;
-			}
-			break;
+// LD (DE), A
+void gb::op12()
+{
+	writeToMemory(DE, A);
+	PC += 1;
+}
 
-		case 0x50: // Loads into D and E.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // LD D, B
-				D = B;
-				PC += 1;
-				break;
+// INC DE
+void gb::op13()
+{
+	INC(DE);
+	PC += 1;
+}
 
-			case 0x01: // LD D, C
-				D = C;
-				PC += 1;
-				break;
+// INC D
+void gb::op14()
+{
+	INC(D);
+	PC += 1;
+}
 
-			case 0x02: // LD D, D
-				D = D;
-				PC += 1;
-				break;
+// DEC D
+void gb::op15()
+{
+	DEC(D);
+	PC += 1;
+}
 
-			case 0x03: // LD D, E
-				D = E;
-				PC += 1;
-				break;
+// LD D, d8
+void gb::op16()
+{
+	D = imm8;
+	PC += 2;
+}
 
-			case 0x04: // LD D, H
-				D = H;
-				PC += 1;
-				break;
+// RLA
+void gb::op17()
+{
+	RL(A);
+	zeroResult = 1;
+	PC += 1;
+}
 
-			case 0x05: // LD D, L
-				D = L;
-				PC += 1;
-				break;
+// JR r8
+void gb::op18()
+{
+	int8_t offset;
+	PC += 1;
+	offset = imm8;
+	PC += offset;
+	PC += 1;
+}
 
-			case 0x06: // LD D, (HL)
-				D = memory[(H << 8) | L];
-				PC += 1;
-				break;
+// ADD HL, DE
+void gb::op19()
+{
+	ADD(HL, DE);
+	PC += 1;
+}
 
-			case 0x07: // LD D, A
-				D = A;
-				PC += 1;
-				break;
+// LD A, (DE)
+void gb::op1A()
+{
+	A = readMemory(DE);
+	PC += 1;
+}
 
-			case 0x08: // LD E, B
-				E = B;
-				PC += 1;
-				break;
+// DEC DE
+void gb::op1B()
+{
+	DEC(DE);
+	PC += 1;
+}
 
-			case 0x09: // LD E, C
-				E = C;
-				PC += 1;
-				break;
+// INC E
+void gb::op1C()
+{
+	INC(E);
+	PC += 1;
+}
 
-			case 0x0A: // LD E, D
-				E = D;
-				PC += 1;
-				break;
+// DEC E
+void gb::op1D()
+{
+	DEC(E);
+	PC += 1;
+}
 
-			case 0x0B: // LD E, E
-				E = E;
-				PC += 1;
-				break;
+// LD E, d8
+void gb::op1E()
+{
+	E = imm8;
+	PC += 2;
+}
 
-			case 0x0C: // LD E, H
-				E = H;
-				PC += 1;
-				break;
+// RRA
+void gb::op1F()
+{
+	RR(A);
+	zeroResult = 1;
+	PC += 1;
+}
 
-			case 0x0D: // LD E, L
-				E = L;
-				PC += 1;
-				break;
+// JR NZ, r8
+void gb::op20()
+{
+	if (zeroResult != 0)
+	{
+		int8_t offset;
+		PC += 1;
+		offset = imm8;
+		PC += offset;
+		PC += 1;
+		cycles += 1;
+	}
+	else
+		PC += 2;
+}
 
-			case 0x0E: // LD E, (HL)
-				E = memory[(H << 8) | L];
-				PC += 1;
-				break;
+// LD HL, d16
+void gb::op21()
+{
+	HL = imm16;
+	PC += 3;
+}
 
-			case 0x0F: // LD E, A
-				E = A;
-				PC += 1;
-				break;
-			}
-			break;
+// LD (HL+), A
+void gb::op22()
+{
+	writeToMemory(HL, A);
+	INC(HL);
+	PC += 1;
+}
 
-		case 0x60: // Loads into H and L.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // LD H, B
-				H = B;
-				PC += 1;
-				break;
+// INC HL
+void gb::op23()
+{
+	INC(HL);
+	PC += 1;
+}
 
-			case 0x01: // LD H, C
-				H = C;
-				PC += 1;
-				break;
+// INC H
+void gb::op24()
+{
+	INC(H);
+	PC += 1;
+}
 
-			case 0x02: // LD H, D
-				H = D;
-				PC += 1;
-				break;
+// DEC H
+void gb::op25()
+{
+	DEC(H);
+	PC += 1;
+}
 
-			case 0x03: // LD H, E
-				H = E;
-				PC += 1;
-				break;
+// LD H, d8
+void gb::op26()
+{
+	H = imm8;
+	PC += 2;
+}
 
-			case 0x04: // LD H, H
-				H = H;
-				PC += 1;
-				break;
+// DAA
+void gb::op27()
+{
+	uint16_t result = daaResult(A, Nb, getH(), Cb);
+	A = result & 0xFF;
+	Cb = result >> 8;
+	zeroResult = A;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+	PC += 1;
+}
 
-			case 0x05: // LD H, L
-				H = L;
-				PC += 1;
-				break;
+// JR Z, r8
+void gb::op28()
+{
+	if (zeroResult == 0)
+	{
+		int8_t offset;
+		PC += 1;
+		offset = imm8;
+		PC += offset;
+		PC += 1;
+		cycles += 1;
+	}
+	else
+		PC += 2;
+}
 
-			case 0x06: // LD H, (HL)
-				H = memory[(H << 8) | L];
-				PC += 1;
-				break;
+// ADD HL, HL
+void gb::op29()
+{
+	ADD(HL, HL);
+	PC += 1;
+}
 
-			case 0x07: // LD H, A
-				H = A;
-				PC += 1;
-				break;
+// LD A, (HL+)
+void gb::op2A()
+{
+	A = readMemory(HL);
+	INC(HL);
+	PC += 1;
+}
 
-			case 0x08: // LD L, B
-				L = B;
-				PC += 1;
-				break;
+// DEC HL
+void gb::op2B()
+{
+	DEC(HL);
+	PC += 1;
+}
 
-			case 0x09: // LD L, C
-				L = C;
-				PC += 1;
-				break;
+// INC L
+void gb::op2C()
+{
+	INC(L);
+	PC += 1;
+}
 
-			case 0x0A: // LD L, D
-				L = D;
-				PC += 1;
-				break;
+// DEC L
+void gb::op2D()
+{
+	DEC(L);
+	PC += 1;
+}
 
-			case 0x0B: // LD L, E
-				L = E;
-				PC += 1;
-				break;
+// LD L, d8
+void gb::op2E()
+{
+	L = imm8;
+	PC += 2;
+}
 
-			case 0x0C: // LD L, H
-				L = H;
-				PC += 1;
-				break;
+// CPL
+void gb::op2F()
+{
+	A = ~A;
+	Nb = 1;
+	setHalfCarry(HALF_SET, 1, 0, 0);
+	PC += 1;
+}
 
-			case 0x0D: // LD L, L
-				L = L;
-				PC += 1;
-				break;
+// JR NC, r8
+void gb::op30()
+{
+	if (Cb == 0)
+	{
+		int8_t offset;
+		PC += 1;
+		offset = imm8;
+		PC += offset;
+		PC += 1;
+		cycles += 1;
+	}
+	else
+		PC += 2;
+}
 
-			case 0x0E: // LD L, (HL)
-				L = memory[(H << 8) | L];
-				PC += 1;
-				break;
+// LD SP, d16
+void gb::op31()
+{
+	SP = imm16;
+	PC += 3;
+}
 
-			case 0x0F: // LD L, A
-				L = A;
-				PC += 1;
-				break;
-			}
-			break;
+// LD (HL-), A
+void gb::op32()
+{
+	writeToMemory(HL, A);
+	DEC(HL);
+	PC += 1;
+}
 
-		case 0x70: // Loads into (HL) and A, also HALT.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // LD (HL), B
-				writeToMemory((H << 8) | L, B);
-				PC += 1;
-				break;
+// INC SP
+void gb::op33()
+{
+	INC(SP);
+	PC += 1;
+}
 
-			case 0x01: // LD (HL), C
-				writeToMemory((H << 8) | L, C);
-				PC += 1;
-				break;
+// INC (HL)
+void gb::op34()
+{
+	uint8_t val = readMemory(HL);
+	INC(val);
+	writeToMemory(HL, val);
+	PC += 1;
+}
 
-			case 0x02: // LD (HL), D
-				writeToMemory((H << 8) | L, D);
-				PC += 1;
-				break;
+// DEC (HL)
+void gb::op35()
+{
+	uint8_t val = readMemory(HL);
+	DEC(val);
+	writeToMemory(HL, val);
+	PC += 1;
+}
 
-			case 0x03: // LD (HL), E
-				writeToMemory((H << 8) | L, E);
-				PC += 1;
-				break;
+// LD (HL), d8
+void gb::op36()
+{
+	writeToMemory(HL, imm8);
+	PC += 2;
+}
 
-			case 0x04: // LD (HL), H
-				writeToMemory((H << 8) | L, H);
-				PC += 1;
-				break;
+// SCF
+void gb::op37()
+{
+	Cb = 1;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+	PC += 1;
+}
 
-			case 0x05: // LD (HL), L
-				writeToMemory((H << 8) | L, L);
-				PC += 1;
-				break;
+// JR C, r8
+void gb::op38()
+{
+	if (Cb == 1)
+	{
+		int8_t offset;
+		PC += 1;
+		offset = imm8;
+		PC += offset;
+		PC += 1;
+		cycles += 1;
+	}
+	else
+		PC += 2;
+}
 
-			case 0x06: // HALT
-				PC += 1;
-				std::cout << "HALTED\n";
-				modifyBit(memory[TAC], 0, 2);
-				break;
+// ADD HL, SP
+void gb::op39()
+{
+	ADD(HL, SP);
+	PC += 1;
+}
 
-			case 0x07: // LD (HL), A
-				writeToMemory((H << 8) | L, A);
-				PC += 1;
-				break;
+// LD A, (HL-)
+void gb::op3A()
+{
+	A = readMemory(HL);
+	DEC(HL);
+	PC += 1;
+}
 
-			case 0x08: // LD A, B
-				A = B;
-				PC += 1;
-				break;
+// DEC SP
+void gb::op3B()
+{
+	DEC(SP);
+	PC += 1;
+}
 
-			case 0x09: // LD A, C
-				A = C;
-				PC += 1;
-				break;
+// INC A
+void gb::op3C()
+{
+	INC(A);
+	PC += 1;
+}
 
-			case 0x0A: // LD A, D
-				A = D;
-				PC += 1;
-				break;
+// DEC A
+void gb::op3D()
+{
+	DEC(A);
+	PC += 1;
+}
 
-			case 0x0B: // LD A, E
-				A = E;
-				PC += 1;
-				break;
+// LD A, d8
+void gb::op3E()
+{
+	A = imm8;
+	PC += 2;
+}
 
-			case 0x0C: // LD A, H
-				A = H;
-				PC += 1;
-				break;
+// CCF
+void gb::op3F()
+{
+	if (Cb == 0)
+		Cb = 1;
+	else
+		Cb = 0;
+	Nb = 0;
+	setHalfCarry(HALF_SET, 0, 0, 0);
+	PC += 1;
+}
 
-			case 0x0D: // LD A, L
-				A = L;
-				PC += 1;
-				break;
+// LD B, B
+void gb::op40()
+{
+	B = B;
+	PC += 1;
+}
 
-			case 0x0E: // LD A, (HL)
-				A = memory[(H << 8) | L];
-				PC += 1;
-				break;
+// LD B, C
+void gb::op41()
+{
+	B = C;
+	PC += 1;
+}
 
-			case 0x0F: // LD A, A
-				A = A;
-				PC += 1;
-				break;
-			}
-			break;
+// LD B, D
+void gb::op42()
+{
+	B = D;
+	PC += 1;
+}
 
-		case 0x80: // Adds and adds with carry.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // ADD A, B
-				ADD(A, B, false);
-				PC += 1;
-				break;
+// LD B, E
+void gb::op43()
+{
+	B = E;
+	PC += 1;
+}
 
-			case 0x01: // ADD A, C
-				ADD(A, C, false);
-				PC += 1;
-				break;
+// LD B, H
+void gb::op44()
+{
+	B = H;
+	PC += 1;
+}
 
-			case 0x02: // ADD A, D
-				ADD(A, D, false);
-				PC += 1;
-				break;
+// LD B, L
+void gb::op45()
+{
+	B = L;
+	PC += 1;
+}
 
-			case 0x03: // ADD A, E
-				ADD(A, E, false);
-				PC += 1;
-				break;
+// LD B, (HL)
+void gb::op46()
+{
+	B = readMemory(HL);
+	PC += 1;
+}
 
-			case 0x04: // ADD A, H
-				ADD(A, H, false);
-				PC += 1;
-				break;
+// LD B, A
+void gb::op47()
+{
+	B = A;
+	PC += 1;
+}
 
-			case 0x05: // ADD A, L
-				ADD(A, L, false);
-				PC += 1;
-				break;
+// LD C, B
+void gb::op48()
+{
+	C = B;
+	PC += 1;
+}
 
-			case 0x06: // ADD A, (HL)
-				ADD(A, memory[H << 8 | L], false);
-				PC += 1;
-				break;
+// LD C, C
+void gb::op49()
+{
+	C = C;
+	PC += 1;
+}
 
-			case 0x07: // ADD A, A
-				ADD(A, A, false);
-				PC += 1;
-				break;
+// LD C, D
+void gb::op4A()
+{
+	C = D;
+	PC += 1;
+}
 
-			case 0x08: // ADC A, B
-				ADD(A, B, true);
-				PC += 1;
-				break;
+// LD C, E
+void gb::op4B()
+{
+	C = E;
+	PC += 1;
+}
 
-			case 0x09: // ADC A, C
-				ADD(A, C, true);
-				PC += 1;
-				break;
+// LD C, H
+void gb::op4C()
+{
+	C = H;
+	PC += 1;
+}
 
-			case 0x0A: // ADC A, D
-				ADD(A, D, true);
-				PC += 1;
-				break;
+// LD C, L
+void gb::op4D()
+{
+	C = L;
+	PC += 1;
+}
 
-			case 0x0B: // ADC A, E
-				ADD(A, E, true);
-				PC += 1;
-				break;
+// LD C, (HL)
+void gb::op4E()
+{
+	C = readMemory(HL);
+	PC += 1;
+}
 
-			case 0x0C: // ADC A, H
-				ADD(A, H, true);
-				PC += 1;
-				break;
+// LD C, A
+void gb::op4F()
+{
+	C = A;
+	PC += 1;
+}
 
-			case 0x0D: // ADC A, L
-				ADD(A, L, true);
-				PC += 1;
-				break;
+// LD D, B
+void gb::op50()
+{
+	D = B;
+	PC += 1;
+}
 
-			case 0x0E: // ADC A, (HL)
-				ADD(A, memory[H << 8 | L], true);
-				PC += 1;
-				break;
+// LD D, C
+void gb::op51()
+{
+	D = C;
+	PC += 1;
+}
 
-			case 0x0F: // ADC A, A
-				ADD(A, A, true);
-				PC += 1;
-				break;
-			}
-			break;
+// LD D, D
+void gb::op52()
+{
+	D = D;
+	PC += 1;
+}
 
-		case 0x90: // Subtractions and subtractions with carry.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // SUB B
-				SUB(B, false);
-				PC += 1;
-				break;
+// LD D, E
+void gb::op53()
+{
+	D = E;
+	PC += 1;
+}
 
-			case 0x01: // SUB C
-				SUB(C, false);
-				PC += 1;
-				break;
+// LD D, H
+void gb::op54()
+{
+	D = H;
+	PC += 1;
+}
 
-			case 0x02: // SUB D
-				SUB(D, false);
-				PC += 1;
-				break;
+// LD D, L
+void gb::op55()
+{
+	D = L;
+	PC += 1;
+}
 
-			case 0x03: // SUB E
-				SUB(E, false);
-				PC += 1;
-				break;
+// LD D, (HL)
+void gb::op56()
+{
+	D = readMemory(HL);
+	PC += 1;
+}
 
-			case 0x04: // SUB H
-				SUB(H, false);
-				PC += 1;
-				break;
+// LD D, A
+void gb::op57()
+{
+	D = A;
+	PC += 1;
+}
 
-			case 0x05: // SUB L
-				SUB(L, false);
-				PC += 1;
-				break;
+// LD E, B
+void gb::op58()
+{
+	E = B;
+	PC += 1;
+}
 
-			case 0x06: // SUB (HL)
-				SUB(memory[H << 8 | L], false);
-				PC += 1;
-				break;
+// LD E, C
+void gb::op59()
+{
+	E = C;
+	PC += 1;
+}
 
-			case 0x07: // SUB A
-				SUB(A, false);
-				PC += 1;
-				break;
+// LD E, D
+void gb::op5A()
+{
+	E = D;
+	PC += 1;
+}
 
-			case 0x08: // SBC A, B
-				SUB(B, true);
-				PC += 1;
-				break;
+// LD E, E
+void gb::op5B()
+{
+	E = E;
+	PC += 1;
+}
 
-			case 0x09: // SBC A, C
-				SUB(C, true);
-				PC += 1;
-				break;
+// LD E, H
+void gb::op5C()
+{
+	E = H;
+	PC += 1;
+}
 
-			case 0x0A: // SBC A, D
-				SUB(D, true);
-				PC += 1;
-				break;
+// LD E, L
+void gb::op5D()
+{
+	E = L;
+	PC += 1;
+}
 
-			case 0x0B: // SBC A, E
-				SUB(E, true);
-				PC += 1;
-				break;
+// LD E, (HL)
+void gb::op5E()
+{
+	E = readMemory(HL);
+	PC += 1;
+}
 
-			case 0x0C: // SBC A, H
-				SUB(H, true);
-				PC += 1;
-				break;
+// LD E, A
+void gb::op5F()
+{
+	E = A;
+	PC += 1;
+}
 
-			case 0x0D: // SBC A, L
-				SUB(L, true);
-				PC += 1;
-				break;
+// LD H, B
+void gb::op60()
+{
+	H = B;
+	PC += 1;
+}
 
-			case 0x0E: // SBC A, (HL)
-				SUB(memory[H << 8 | L], true);
-				PC += 1;
-				break;
+// LD H, C
+void gb::op61()
+{
+	H = C;
+	PC += 1;
+}
 
-			case 0x0F: // SBC A, A
-				SUB(A, true);
-				PC += 1;
-				break;
-			}
-			break;
+// LD H, D
+void gb::op62()
+{
+	H = D;
+	PC += 1;
+}
 
-		case 0xA0: // ANDs and XORs.
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // AND B
-				AND(B);
-				PC += 1;
-				break;
+// LD H, E
+void gb::op63()
+{
+	H = E;
+	PC += 1;
+}
 
-			case 0x01: // AND C
-				AND(C);
-				PC += 1;
-				break;
+// LD H, H
+void gb::op64()
+{
+	H = H;
+	PC += 1;
+}
 
-			case 0x02: // AND D
-				AND(D);
-				PC += 1;
-				break;
+// LD H, L
+void gb::op65()
+{
+	H = L;
+	PC += 1;
+}
 
-			case 0x03: // AND E
-				AND(E);
-				PC += 1;
-				break;
+// LD H, (HL)
+void gb::op66()
+{
+	H = readMemory(HL);
+	PC += 1;
+}
 
-			case 0x04: // AND H
-				AND(H);
-				PC += 1;
-				break;
+// LD H, A
+void gb::op67()
+{
+	H = A;
+	PC += 1;
+}
 
-			case 0x05: // AND L
-				AND(L);
-				PC += 1;
-				break;
+// LD L, B
+void gb::op68()
+{
+	L = B;
+	PC += 1;
+}
 
-			case 0x06: // AND (HL)
-				AND(memory[H << 8 | L]);
-				PC += 1;
-				break;
+// LD L, C
+void gb::op69()
+{
+	L = C;
+	PC += 1;
+}
 
-			case 0x07: // AND A
-				AND(A);
-				PC += 1;
-				break;
+// LD L, D
+void gb::op6A()
+{
+	L = D;
+	PC += 1;
+}
 
-			case 0x08: // XOR B
-				XOR(B);
-				PC += 1;
-				break;
+// LD L, E
+void gb::op6B()
+{
+	L = E;
+	PC += 1;
+}
 
-			case 0x09: // XOR C
-				XOR(C);
-				PC += 1;
-				break;
+// LD L, H
+void gb::op6C()
+{
+	L = H;
+	PC += 1;
+}
 
-			case 0x0A: // XOR D
-				XOR(D);
-				PC += 1;
-				break;
+// LD L, L
+void gb::op6D()
+{
+	L = L;
+	PC += 1;
+}
 
-			case 0x0B: // XOR E
-				XOR(E);
-				PC += 1;
-				break;
+// LD L, (HL)
+void gb::op6E()
+{
+	L = readMemory(HL);
+	PC += 1;
+}
 
-			case 0x0C: // XOR H
-				XOR(H);
-				PC += 1;
-				break;
+// LD L, A
+void gb::op6F()
+{
+	L = A;
+	PC += 1;
+}
 
-			case 0x0D: // XOR L
-				XOR(L);
-				PC += 1;
-				break;
+// LD (HL), B
+void gb::op70()
+{
+	writeToMemory(HL, B);
+	PC += 1;
+}
 
-			case 0x0E: // XOR (HL)
-				XOR(memory[H << 8 | L]);
-				PC += 1;
-				break;
+// LD (HL), C
+void gb::op71()
+{
+	writeToMemory(HL, C);
+	PC += 1;
+}
 
-			case 0x0F: // XOR A
-				XOR(A);
-				Zb = 1;
-				PC += 1;
-				break;
-			}
-			break;
+// LD (HL), D
+void gb::op72()
+{
+	writeToMemory(HL, D);
+	PC += 1;
+}
 
-		case 0xB0:
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // OR B
-				OR(B);
-				PC += 1;
-				break;
+// LD (HL), E
+void gb::op73()
+{
+	writeToMemory(HL, E);
+	PC += 1;
+}
 
-			case 0x01: // OR C
-				OR(C);
-				PC += 1;
-				break;
+// LD (HL), H
+void gb::op74()
+{
+	writeToMemory(HL, H);
+	PC += 1;
+}
 
-			case 0x02: // OR D
-				OR(D);
-				PC += 1;
-				break;
+// LD (HL), L
+void gb::op75()
+{
+	writeToMemory(HL, L);
+	PC += 1;
+}
 
-			case 0x03: // OR E
-				OR(E);
-				PC += 1;
-				break;
+// HALT
+void gb::op76()
+{
+	PC += 1;
 
-			case 0x04: // OR H
-				OR(H);
-				PC += 1;
-				break;
+	// If IME is off and an interrupt is already pending, HALT ends at once and the CPU fails to move
+	// past the next opcode (the HALT bug).
+	if (!IME && (readMemory(IE) & readMemory(IF) & 0x1F))
+		haltBug = true;
+	else
+		halted = true;
+}
 
-			case 0x05: // OR L
-				OR(L);
-				PC += 1;
-				break;
+// LD (HL), A
+void gb::op77()
+{
+	writeToMemory(HL, A);
+	PC += 1;
+}
 
-			case 0x06: // OR (HL)
-				OR(memory[H << 8 | L]);
-				PC += 1;
-				break;
+// LD A, B
+void gb::op78()
+{
+	A = B;
+	PC += 1;
+}
 
-			case 0x07: // OR A
-				OR(A);
-				PC += 1;
-				break;
+// LD A, C
+void gb::op79()
+{
+	A = C;
+	PC += 1;
+}
 
-			case 0x08: // CP B
-				CP(B);
-				PC += 1;
-				break;
+// LD A, D
+void gb::op7A()
+{
+	A = D;
+	PC += 1;
+}
 
-			case 0x09: // CP C
-				CP(C);
-				PC += 1;
-				break;
+// LD A, E
+void gb::op7B()
+{
+	A = E;
+	PC += 1;
+}
 
-			case 0x0A: // CP D
-				CP(D);
-				PC += 1;
-				break;
+// LD A, H
+void gb::op7C()
+{
+	A = H;
+	PC += 1;
+}
 
-			case 0x0B: // CP E
-				CP(E);
-				PC += 1;
-				break;
+// LD A, L
+void gb::op7D()
+{
+	A = L;
+	PC += 1;
+}
 
-			case 0x0C: // CP H
-				CP(H);
-				PC += 1;
-				break;
+// LD A, (HL)
+void gb::op7E()
+{
+	A = readMemory(HL);
+	PC += 1;
+}
 
-			case 0x0D: // CP L
-				CP(L);
-				PC += 1;
-				break;
+// LD A, A
+void gb::op7F()
+{
+	A = A;
+	PC += 1;
+}
 
-			case 0x0E: // CP (HL)
-				CP(memory[H << 8 | L]);
-				PC += 1;
-				break;
+// ADD A, B
+void gb::op80()
+{
+	ADD(A, B, false);
+	PC += 1;
+}
 
-			case 0x0F: // CP A
-				CP(A);
-				Zb = 1; // Necessary?
-				PC += 1;
-				break;
-			}
-			break;
+// ADD A, C
+void gb::op81()
+{
+	ADD(A, C, false);
+	PC += 1;
+}
 
-		case 0xC0:
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // RET NZ
-				if (Zb == 0)
-				{
-					PC = (memory[SP + 1] << 8) | memory[SP];
-					SP += 2;
-				}
-				else
-				{
-					PC += 1;
-				}
-				break;
+// ADD A, D
+void gb::op82()
+{
+	ADD(A, D, false);
+	PC += 1;
+}
 
-			case 0x01: // POP BC
-				B = memory[SP + 1];
-				C = memory[SP];
-				SP += 2;
-				PC += 1;
-				break;
+// ADD A, E
+void gb::op83()
+{
+	ADD(A, E, false);
+	PC += 1;
+}
 
-			case 0x02: // JP NZ, a16
-				if (Zb == 0)
-				{
-					PC = (memory[PC + 2] << 8) | memory[PC + 1];
-				}
-				else
-				{
-					PC += 3;
-				}
-				break;
+// ADD A, H
+void gb::op84()
+{
+	ADD(A, H, false);
+	PC += 1;
+}
 
-			case 0x03: // JP a16
-				PC = (memory[PC + 2] << 8) | memory[PC + 1];
-				break;
+// ADD A, L
+void gb::op85()
+{
+	ADD(A, L, false);
+	PC += 1;
+}
 
-			case 0x04: // CALL NZ, a16
-				if (Zb == 0)
-					CALL();
-				else
-					PC += 3;
-				break;
+// ADD A, (HL)
+void gb::op86()
+{
+	ADD(A, readMemory(HL), false);
+	PC += 1;
+}
 
-			case 0x05: // PUSH BC
-				writeToMemory(SP - 1, B);
-				writeToMemory(SP - 2, C);
-				SP -= 2;
-				PC += 1;
-				break;
+// ADD A, A
+void gb::op87()
+{
+	ADD(A, A, false);
+	PC += 1;
+}
 
-			case 0x06: // ADD A, d8
-				ADD(A, memory[PC + 1], false);
-				PC += 2;
-				break;
+// ADC A, B
+void gb::op88()
+{
+	ADD(A, B, true);
+	PC += 1;
+}
 
-			case 0x07: // RST 00H
-				RST(0x0);
-				break;
+// ADC A, C
+void gb::op89()
+{
+	ADD(A, C, true);
+	PC += 1;
+}
 
-			case 0x08: // RET Z
-				if (Zb == 1)
-				{
-					PC = (memory[SP + 1] << 8) | memory[SP];
-					SP += 2;
-				}
-				else
-				{
-					PC += 1;
-				}
-				break;
+// ADC A, D
+void gb::op8A()
+{
+	ADD(A, D, true);
+	PC += 1;
+}
 
-			case 0x09: // RET
-				PC = (memory[SP + 1] << 8) | memory[SP];
-				SP += 2;
-				break;
+// ADC A, E
+void gb::op8B()
+{
+	ADD(A, E, true);
+	PC += 1;
+}
 
-			case 0x0A: // JP Z, a16
-				if (Zb == 1)
-				{
-					PC = (memory[PC + 2] << 8) | memory[PC + 1];
-				}
-				else
-				{
-					PC += 3;
-				}
-				break;
+// ADC A, H
+void gb::op8C()
+{
+	ADD(A, H, true);
+	PC += 1;
+}
 
-			case 0x0C: // CALL Z, a16
-				if (Zb == 1)
-					CALL();
-				else
-					PC += 3;
-				break;
+// ADC A, L
+void gb::op8D()
+{
+	ADD(A, L, true);
+	PC += 1;
+}
 
-			case 0x0D: // CALL a16
-				CALL();
-				break;
+// ADC A, (HL)
+void gb::op8E()
+{
+	ADD(A, readMemory(HL), true);
+	PC += 1;
+}
 
-			case 0x0E: // ADC A, d8
-				ADD(A, memory[PC + 1], true);
-				PC += 2;
-				break;
+// ADC A, A
+void gb::op8F()
+{
+	ADD(A, A, true);
+	PC += 1;
+}
 
-			case 0x0F: // RST 08H
-				RST(0x08);
-				break;
-			}
-			break;
+// SUB B
+void gb::op90()
+{
+	SUB(B, false);
+	PC += 1;
+}
 
-		case 0xD0:
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // RET NC
-				if (Cb == 0)
-				{
-					PC = (memory[SP + 1] << 8) | memory[SP];
-					SP += 2;
-				}
-				else
-				{
-					PC += 1;
-				}
-				break;
+// SUB C
+void gb::op91()
+{
+	SUB(C, false);
+	PC += 1;
+}
 
-			case 0x01: // POP DE
-				D = memory[SP + 1];
-				E = memory[SP];
-				SP += 2;
-				PC += 1;
-				break;
+// SUB D
+void gb::op92()
+{
+	SUB(D, false);
+	PC += 1;
+}
 
-			case 0x02: // JP NC, a16
-				if (Cb == 0)
-				{
-					PC = (memory[PC + 2] << 8) | memory[PC + 1];
-				}
-				else
-				{
-					PC += 3;
-				}
-				break;
+// SUB E
+void gb::op93()
+{
+	SUB(E, false);
+	PC += 1;
+}
 
-			case 0x03:
-				std::cerr << "Unknown instruction D3!\n";
-				PC += 1;
-				break;
+// SUB H
+void gb::op94()
+{
+	SUB(H, false);
+	PC += 1;
+}
 
-			case 0x04: // CALL NC, a16
-				if (Cb == 0)
-					CALL();
-				else
-					PC += 3;
-				break;
+// SUB L
+void gb::op95()
+{
+	SUB(L, false);
+	PC += 1;
+}
 
-			case 0x05: // PUSH DE
-				writeToMemory(SP - 1, D);
-				writeToMemory(SP - 2, E);
-				SP -= 2;
-				PC += 1;
-				break;
+// SUB (HL)
+void gb::op96()
+{
+	SUB(readMemory(HL), false);
+	PC += 1;
+}
 
-			case 0x06: // SUB d8
-				SUB(memory[PC + 1], false);
-				PC += 2;
-				break;
+// SUB A
+void gb::op97()
+{
+	SUB(A, false);
+	PC += 1;
+}
 
-			case 0x07: // RST 10H
-				RST(0x10);
-				break;
+// SBC A, B
+void gb::op98()
+{
+	SUB(B, true);
+	PC += 1;
+}
 
-			case 0x08: // RET C
-				if (Cb == 1)
-				{
-					PC = (memory[SP + 1] << 8) | memory[SP];
-					SP += 2;
-				}
-				else
-				{
-					PC += 1;
-				}
-				break;
+// SBC A, C
+void gb::op99()
+{
+	SUB(C, true);
+	PC += 1;
+}
 
-			case 0x09: // RETI
-				PC = (memory[SP + 1] << 8) | memory[SP];
-				SP += 2;
-				EI();
-				break;
+// SBC A, D
+void gb::op9A()
+{
+	SUB(D, true);
+	PC += 1;
+}
 
-			case 0x0A: // JP C, a16
-				if (Cb == 1)
-				{
-					PC = (memory[PC + 2] << 8) | memory[PC + 1];
-				}
-				else
-				{
-					PC += 3;
-				}
-				break;
+// SBC A, E
+void gb::op9B()
+{
+	SUB(E, true);
+	PC += 1;
+}
 
-			case 0x0B:
-				std::cerr << "Unknown instruction DB!\n";
-				PC += 1;
-				break;
+// SBC A, H
+void gb::op9C()
+{
+	SUB(H, true);
+	PC += 1;
+}
 
-			case 0x0C: // CALL C, a16
-				if (Cb == 1)
-					CALL();
-				else
-					PC += 3;
-				break;
+// SBC A, L
+void gb::op9D()
+{
+	SUB(L, true);
+	PC += 1;
+}
 
-			case 0x0D:
-				std::cerr << "Unknown instruction DD!\n";
-				PC += 1;
-				break;
+// SBC A, (HL)
+void gb::op9E()
+{
+	SUB(readMemory(HL), true);
+	PC += 1;
+}
 
-			case 0x0E: // SBC A, d8
-				SUB(memory[PC + 1], true);
-				PC += 2;
-				break;
+// SBC A, A
+void gb::op9F()
+{
+	SUB(A, true);
+	PC += 1;
+}
 
-			case 0x0F: // RST 18H
-				RST(0x18);
-				break;
-			}
-			break;
+// AND B
+void gb::opA0()
+{
+	AND(B);
+	PC += 1;
+}
 
-		case 0xE0:
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // LDH (a8), A
-				writeToMemory(0xFF00 + memory[PC + 1], A);
-				PC += 2;
-				break;
+// AND C
+void gb::opA1()
+{
+	AND(C);
+	PC += 1;
+}
 
-			case 0x01: // POP HL
-				H = memory[SP + 1];
-				L = memory[SP];
-				SP += 2;
-				PC += 1;
-				break;
+// AND D
+void gb::opA2()
+{
+	AND(D);
+	PC += 1;
+}
 
-			case 0x02: // LDH (C), A
-				writeToMemory(0xFF00 + C, A);
-				PC += 1;
-				break;
+// AND E
+void gb::opA3()
+{
+	AND(E);
+	PC += 1;
+}
 
-			case 0x03:
-				std::cerr << "Unknown instruction E3!\n";
-				PC += 1;
-				break;
+// AND H
+void gb::opA4()
+{
+	AND(H);
+	PC += 1;
+}
 
-			case 0x04:
-				std::cerr << "Unknown instruction E4!\n";
-				PC += 1;
-				break;
+// AND L
+void gb::opA5()
+{
+	AND(L);
+	PC += 1;
+}
 
-			case 0x05: // PUSH HL
-				writeToMemory(SP - 1, H);
-				writeToMemory(SP - 2, L);
-				SP -= 2;
-				PC += 1;
-				break;
+// AND (HL)
+void gb::opA6()
+{
+	AND(readMemory(HL));
+	PC += 1;
+}
 
-			case 0x06: // AND d8
-				AND(memory[PC + 1]);
-				PC += 2;
-				break;
+// AND A
+void gb::opA7()
+{
+	AND(A);
+	PC += 1;
+}
 
-			case 0x07: // RST 20H
-				RST(0x20);
-				break;
+// XOR B
+void gb::opA8()
+{
+	XOR(B);
+	PC += 1;
+}
 
-			case 0x08: // ADD SP, r8
-				ADD(SP, static_cast<int8_t>(memory[PC + 1]));
-				PC += 2;
-				break;
+// XOR C
+void gb::opA9()
+{
+	XOR(C);
+	PC += 1;
+}
 
-			case 0x09: // JP HL
-				PC = (H << 8) | L;
-				break;
+// XOR D
+void gb::opAA()
+{
+	XOR(D);
+	PC += 1;
+}
 
-			case 0x0A: // LD (a16), A
-				writeToMemory((memory[PC + 2] << 8) | memory[PC + 1], A);
-				PC += 3;
-				break;
+// XOR E
+void gb::opAB()
+{
+	XOR(E);
+	PC += 1;
+}
 
-			case 0x0B:
-				std::cerr << "Unknown instruction EB!\n";
-				PC += 1;
-				break;
+// XOR H
+void gb::opAC()
+{
+	XOR(H);
+	PC += 1;
+}
 
-			case 0x0C:
-				std::cerr << "Unknown instruction EC!\n";
-				PC += 1;
-				break;
+// XOR L
+void gb::opAD()
+{
+	XOR(L);
+	PC += 1;
+}
 
-			case 0x0D:
-				std::cerr << "Unknown instruction ED!\n";
-				PC += 1;
-				break;
+// XOR (HL)
+void gb::opAE()
+{
+	XOR(readMemory(HL));
+	PC += 1;
+}
 
-			case 0x0E: // XOR d8
-				XOR(memory[PC + 1]);
-				PC += 2;
-				break;
+// XOR A
+void gb::opAF()
+{
+	XOR(A);
+	zeroResult = 0;
+	PC += 1;
+}
 
-			case 0x0F: // RST 28H
-				RST(0x28);
-				break;
-			}
-			break;
+// OR B
+void gb::opB0()
+{
+	OR(B);
+	PC += 1;
+}
 
-		case 0xF0:
-			switch (opcode & 0x0F)
-			{
-			case 0x00: // LDH A, (a8)
-				A = memory[0xFF00 + memory[PC + 1]];
-				PC += 2;
-				break;
+// OR C
+void gb::opB1()
+{
+	OR(C);
+	PC += 1;
+}
 
-			case 0x01: // POP AF
-				A = memory[SP + 1];
-				F = (memory[SP] & 0xF0);
-				SP += 2;
-				PC += 1;
-				Zb = (F >> 7) & 0x1;
-				Nb = (F >> 6) & 0x1;
-				Hb = (F >> 5) & 0x1;
-				Cb = (F >> 4) & 0x1;
-				break;
+// OR D
+void gb::opB2()
+{
+	OR(D);
+	PC += 1;
+}
 
-			case 0x02: // LDH A, (C)
-				A = memory[0xFF00 + C];
-				PC += 1;
-				break;
+// OR E
+void gb::opB3()
+{
+	OR(E);
+	PC += 1;
+}
 
-			case 0x03: // DI
-				DI();
-				PC += 1;
-				break;
+// OR H
+void gb::opB4()
+{
+	OR(H);
+	PC += 1;
+}
 
-			case 0x04:
-				std::cerr << "Unknown instruction F4!\n";
-				PC += 1;
-				break;
+// OR L
+void gb::opB5()
+{
+	OR(L);
+	PC += 1;
+}
 
-			case 0x05: // PUSH AF
-				writeToMemory(SP - 1, A);
-				writeToMemory(SP - 2, F);
-				SP -= 2;
-				PC += 1;
-				break;
+// OR (HL)
+void gb::opB6()
+{
+	OR(readMemory(HL));
+	PC += 1;
+}
 
-			case 0x06: // OR d8
-				OR(memory[PC + 1]);
-				PC += 2;
-				break;
+// OR A
+void gb::opB7()
+{
+	OR(A);
+	PC += 1;
+}
 
-			case 0x07: // RST 30H
-				RST(0x30);
-				break;
+// CP B
+void gb::opB8()
+{
+	CP(B);
+	PC += 1;
+}
 
-			case 0x08: // LD HL, SP + r8
-			{
-				int16_t val = memory[PC + 1];
-				uint16_t tempSP = SP;
-				ADD(tempSP, static_cast<int8_t>(val));
-				H = (tempSP >> 8) & 0xFF;
-				L = tempSP & 0xFF;
-				PC += 2;
-				break;
-			}
+// CP C
+void gb::opB9()
+{
+	CP(C);
+	PC += 1;
+}
 
-			case 0x09: // LD SP, HL
-				SP = (H << 8) | L;
-				PC += 1;
-				break;
+// CP D
+void gb::opBA()
+{
+	CP(D);
+	PC += 1;
+}
 
-			case 0x0A: // LD A, (a16)
-			{
-				uint16_t addr = memory[PC + 2] << 8 | memory[PC + 1];
-				A = memory[addr];
-				PC += 3;
-				break;
-			}
+// CP E
+void gb::opBB()
+{
+	CP(E);
+	PC += 1;
+}
 
-			case 0x0B: // EI
-				cyclesBeforeEnableIME = 1;
-				scheduleIME = true;
-				PC += 1;
-				break;
+// CP H
+void gb::opBC()
+{
+	CP(H);
+	PC += 1;
+}
 
-			case 0x0C:
-				std::cerr << "Unknown instruction FC!\n";
-				PC += 1;
-				break;
+// CP L
+void gb::opBD()
+{
+	CP(L);
+	PC += 1;
+}
 
-			case 0x0D:
-				std::cerr << "Unknown instruction FD!\n";
-				PC += 1;
-				break;
+// CP (HL)
+void gb::opBE()
+{
+	CP(readMemory(HL));
+	PC += 1;
+}
 
-			case 0x0E: // CP d8
-				CP(memory[PC + 1]);
-				PC += 2;
-				break;
+// CP A
+void gb::opBF()
+{
+	CP(A);
+	zeroResult = 0; // Necessary?
+	PC += 1;
+}
 
-			case 0x0F: // RST 38H
-				RST(0x38);
-				break;
-			}
-			break;
-		}
+// RET NZ
+void gb::opC0()
+{
+	if (zeroResult != 0)
+	{
+		PC = (readMemory(SP + 1) << 8) | readMemory(SP);
+		SP += 2;
+		cycles += 3;
+	}
+	else
+	{
+		PC += 1;
 	}
+}
 
-	
-	updateFlagReg(); // Update F with the new flag values.
+// POP BC
+void gb::opC1()
+{
+	B = readMemory(SP + 1);
+	C = readMemory(SP);
+	SP += 2;
+	PC += 1;
+}
 
-	// Timer
+// JP NZ, a16
+void gb::opC2()
+{
+	if (zeroResult != 0)
+	{
+		PC = imm16;
+		cycles += 1;
+	}
+	else
+	{
+		PC += 3;
+	}
+}
 
-	memory[DIV] = counter >> 8; // DIV is upper 8 bits of internal counter.
+// JP a16
+void gb::opC3()
+{
+	PC = imm16;
+}
 
-	if (((memory[TAC] >> 2) & 0x1) == 0x1) // If timer enabled.
+// CALL NZ, a16
+void gb::opC4()
+{
+	if (zeroResult != 0)
 	{
-		if ((memory[TAC] & 0x3) == 0x0)
-		{
-			if (counter % 256 == 0)
-				incTimer();
-		}
-		else if ((memory[TAC] & 0x3) == 0x1)
-		{
-			if (counter % 4 == 0)
-				incTimer();
-		}
-		else if ((memory[TAC] & 0x3) == 0x2)
-		{
-			if (counter % 16 == 0)
-				incTimer();
-		}
-		else if ((memory[TAC] & 0x3) == 0x3)
-		{
-			if (counter % 64 == 0)
-				incTimer();
-		}
+		CALL();
+		cycles += 3;
 	}
-	//std::cout << "Counter: " << counter << ", DIV: " << (int)memory[DIV] << "TIMA: " << (int)memory[TIMA] << '\n';
-	counter += 1;
+	else
+		PC += 3;
 }
 
-// Increments the TIMA register, accounting for overflow.
-void gb::incTimer()
+// PUSH BC
+void gb::opC5()
 {
-	memory[TIMA] += 1;
-	if (memory[TIMA] == 0x0)  // Overflowed.
-	{
-		memory[TIMA] = memory[TMA];
-		modifyBit(memory[IF], 1, 2); // Timer interrupt.
-	}
+	writeToMemory(SP - 1, B);
+	writeToMemory(SP - 2, C);
+	SP -= 2;
+	PC += 1;
 }
 
-// Updates F with the cuurrent flag values.
-void gb::updateFlagReg()
+// ADD A, d8
+void gb::opC6()
 {
-	// Set each flag bit to the value it should be in the register F.
-	modifyBit(F, Zb, 7);
-	modifyBit(F, Nb, 6);
-	modifyBit(F, Hb, 5);
-	modifyBit(F, Cb, 4);
+	ADD(A, imm8, false);
+	PC += 2;
 }
 
-// Set or reset a bit in a byte, at a given position.
-void gb::modifyBit(uint8_t &val, int bitVal, int pos)
+// RST 00H
+void gb::opC7()
 {
-	// Bit masks are used to modify the value of the bit.
-	if (bitVal == 0)
+	RST(0x0);
+}
+
+// RET Z
+void gb::opC8()
+{
+	if (zeroResult == 0)
 	{
-		val &= ~(0x1 << pos);
+		PC = (readMemory(SP + 1) << 8) | readMemory(SP);
+		SP += 2;
+		cycles += 3;
 	}
-	else if (bitVal == 1)
+	else
 	{
-		val |= 0x1 << pos;
+		PC += 1;
 	}
 }
 
-// Check if the half-carry bit should be set for an addition/subtraction of two bytes.
-bool gb::checkHalfCarry(uint8_t a, uint8_t b, char mode)
+// RET
+void gb::opC9()
 {
-	if (mode == '+')
-		if (((a & 0xF) + (b & 0xF)) > 0xF)
-			return 1;
-		else
-			return 0;
+	PC = (readMemory(SP + 1) << 8) | readMemory(SP);
+	SP += 2;
+}
 
-	else if (mode == '-')
-		if ((a & 0xF) < (b & 0xF))
-			return 1;
-		else
-			return 0;
-	
-	return Hb; // Return current Hb if incorrect mode entered.
+// JP Z, a16
+void gb::opCA()
+{
+	if (zeroResult == 0)
+	{
+		PC = imm16;
+		cycles += 1;
+	}
+	else
+	{
+		PC += 3;
+	}
 }
 
-// Check if the half-carry bit should be set for an addition/subtraction of two 16-bit values.
-bool gb::checkHalfCarry(uint16_t val1, uint16_t val2, char mode)
+// PREFIX CB
+void gb::opCB()
 {
-	if (mode == '+')
-		if (((val1 & 0xFFF) + (val2 & 0xFFF)) > 0xFFF)
-			return 1;
-		else
-			return 0;
+	PC += 1;
+	opcode = imm8;
+	cycles = cbCycles[opcode];
+	(this->*cbTable[opcode])();
+}
 
-	else if (mode == '-')
-		if (((val1 & 0xFFF) - (val2 & 0xFFF)) < 0xFFF)
-			return 1;
-		else
-			return 0;
+// CALL Z, a16
+void gb::opCC()
+{
+	if (zeroResult == 0)
+	{
+		CALL();
+		cycles += 3;
+	}
+	else
+		PC += 3;
+}
 
-	return Hb; // Return current Hb if incorrect mode entered.
+// CALL a16
+void gb::opCD()
+{
+	CALL();
 }
 
-// Check if the zero flag should be set based on a input value.
-bool gb::checkZero(uint8_t val)
+// ADC A, d8
+void gb::opCE()
 {
-	if (val == 0)
-		return 1;
-	else
-		return 0;
+	ADD(A, imm8, true);
+	PC += 2;
 }
 
-// Returns the 16-bit value when combining two 8-bit register values together.
-uint16_t gb::combineReg(uint8_t reg1, uint8_t reg2)
+// RST 08H
+void gb::opCF()
 {
-	return (reg1 << 8) | reg2;
+	RST(0x08);
 }
 
-// Used to control memory writes by instructions in the CPU's instruction set. Writes to memory
-// locations performed outside of actual CPU instructions can write directly to memory, e.g. 
-// updating the JOYP register when an input is detected.
-void gb::writeToMemory(uint16_t addr, uint8_t data)
+// RET NC
+void gb::opD0()
 {
-	if (addr < 0x8000) // ROM bank
-	{
-		return;
-	}
-	else if (0xDDFF >= addr >= 0xC000)	// Work RAM (mirrored to echo RAM)
-	{
-		memory[addr] = data;
-		memory[addr + 0x2000] = data;
-	}
-	else if (0xFDFF >= addr >= 0xE000)	// Echo RAM
-	{
-		memory[addr] = data;
-		memory[addr - 0x2000] = data;
-	}
-	else if (0xFEFF >= addr >= 0xFEA0)	// Unused range
+	if (Cb == 0)
 	{
-		printf("Game tried to write to unusable range! addr = %X, data = %X\n", addr, data);
-	}
-	else if (addr == 0xFF00)  // JOYP
-	{
-		modifyBit(memory[addr], (data >> 4) & 0x1, 4);
-		modifyBit(memory[addr], (data >> 5) & 0x1, 5);
+		PC = (readMemory(SP + 1) << 8) | readMemory(SP);
+		SP += 2;
+		cycles += 3;
 	}
-	else if (addr == 0xFF04)			// DIV register
+	else
 	{
-		memory[addr] = 0x0;
+		PC += 1;
 	}
-	else if (addr == 0xFF05)			// TAC register
+}
+
+// POP DE
+void gb::opD1()
+{
+	D = readMemory(SP + 1);
+	E = readMemory(SP);
+	SP += 2;
+	PC += 1;
+}
+
+// JP NC, a16
+void gb::opD2()
+{
+	if (Cb == 0)
 	{
-		modifyBit(memory[TAC], data & 0x1, 0);
-		modifyBit(memory[TAC], (data >> 1) & 0x1, 1);
-		modifyBit(memory[TAC], (data >> 2) & 0x1, 2);
+		PC = imm16;
+		cycles += 1;
 	}
-	else if (addr == 0xFF46)			// DMA transfer
+	else
 	{
-		memory[0xFF46] = data;
-		for (int i = 0; i < 0xA0; i++)
-			memory[0xFE00 | i] = memory[(memory[0xFF46] * 0x100) | i];
+		PC += 3;
 	}
-	else								// Unconditional transfer
-		memory[addr] = data;
 }
 
-// Puts the value in a 16-bit register back into the two original registers.
-void gb::splitReg(uint8_t &reg1, uint8_t &reg2, uint16_t reg3)
+// Unknown instruction.
+void gb::opD3()
 {
-	reg1 = reg3 >> 8 & 0xFF;
-	reg2 = reg3 & 0xFF;
+	std::cerr << "Unknown instruction D3!\n";
+	PC += 1;
 }
 
-// Increment a byte.
-void gb::INC(uint8_t &val)
+// CALL NC, a16
+void gb::opD4()
 {
-	Hb = checkHalfCarry(val, 0x1, '+');
-	val += 1;
-	Zb = checkZero(val);
-	Nb = 0;
+	if (Cb == 0)
+	{
+		CALL();
+		cycles += 3;
+	}
+	else
+		PC += 3;
 }
 
-// Increment a 16-bit value.
-void gb::INC(uint16_t &val)
+// PUSH DE
+void gb::opD5()
 {
-	val += 1;
+	writeToMemory(SP - 1, D);
+	writeToMemory(SP - 2, E);
+	SP -= 2;
+	PC += 1;
 }
 
-// Decrement a byte.
-void gb::DEC(uint8_t &val)
+// SUB d8
+void gb::opD6()
 {
-	Hb = checkHalfCarry(val, 0x1, '-');
-	val -= 1;
-	Zb = checkZero(val);
-	Nb = 1;
+	SUB(imm8, false);
+	PC += 2;
 }
 
-// Decrement a 16-bit value.
-void gb::DEC(uint16_t &val)
+// RST 10H
+void gb::opD7()
 {
-	val -= 1;
+	RST(0x10);
 }
 
-// Adds a byte value to another byte, with or without adding the carry bit.
-void gb::ADD(uint8_t &val1, uint8_t val2, bool carry)
+// RET C
+void gb::opD8()
 {
-	// Adding the carry bit along with the given value.
-	if (carry)
+	if (Cb == 1)
 	{
-		/*The value of the carry bit is calculated before adding. However, we need to add the carry bit after, so we
-		store the new value here and update the carry bit after adding.*/
-		uint8_t newCb = (val1 > (0xFF - val2 - Cb));
-	
-		Hb = (((val1 & 0xF) + (val2 & 0xF) + Cb) > 0xF);
-		val1 += val2 + Cb;
-		Cb = newCb;
-	}	
-
-	// Adding without the carry bit.
+		PC = (readMemory(SP + 1) << 8) | readMemory(SP);
+		SP += 2;
+		cycles += 3;
+	}
 	else
 	{
-		Cb = val1 > (0xFF - val2);
-		Hb = checkHalfCarry(val1, val2, '+');
-		val1 += val2;
+		PC += 1;
 	}
-	Zb = checkZero(val1);
-	Nb = 0;
 }
 
-// Adds a 16-bit value to another 16-bit value.
-void gb::ADD(uint16_t &val1, uint16_t val2)
+// RETI
+void gb::opD9()
 {
-	if (val1 > (0xFFFF - val2))
-		Cb = 1;
-	else
-		Cb = 0;
-
-	Hb = checkHalfCarry(val1, val2, '+');
-	val1 += val2;
-	Nb = 0;
+	PC = (readMemory(SP + 1) << 8) | readMemory(SP);
+	SP += 2;
+	EI();
 }
 
-// Adds a signed 8-bit value to an unsigned 16-bit value.
-void gb::ADD(uint16_t &val1, int8_t val2)
+// JP C, a16
+void gb::opDA()
 {
-	if ((val1 & 0xFF) > (0xFF - (val2 & 0xFF)))
-		Cb = 1;
+	if (Cb == 1)
+	{
+		PC = imm16;
+		cycles += 1;
+	}
 	else
-		Cb = 0;
-	Hb = ((val1 & 0xF) + (val2 & 0xF) > 0xF);
+	{
+		PC += 3;
+	}
+}
 
-	val1 += val2;
-	Nb = 0;
-	Zb = 0;
+// Unknown instruction.
+void gb::opDB()
+{
+	std::cerr << "Unknown instruction DB!\n";
+	PC += 1;
 }
 
-// Subtract an 8-bit value from A, along with the carry bit if required.
-void gb::SUB(uint8_t val, bool carry)
+// CALL C, a16
+void gb::opDC()
 {
-	// Subtracting the given value and the carry bit.
-	if (carry)
+	if (Cb == 1)
 	{
-		/*The value of the carry bit is calculated before subtracting. However, we need 
-		to subtract the carry bit after, so we store the new value here and update the carry 
-		bit after subtracting.*/
-		uint8_t newCb = (val + Cb > A);
-
-		Hb = (((A & 0xF) < (val & 0xF) + Cb));
-		A = A - val - Cb;
-		Cb = newCb;
+		CALL();
+		cycles += 3;
 	}
-
-	// Subtracting without the carry bit.
 	else
-	{
-		Cb = val > A;
-		Hb = checkHalfCarry(A, val, '-');
-		A -= val;
-	}
+		PC += 3;
+}
 
-	Zb = checkZero(A);
-	Nb = 1;
+// Unknown instruction.
+void gb::opDD()
+{
+	std::cerr << "Unknown instruction DD!\n";
+	PC += 1;
 }
 
-// ANDs A with a value.
-void gb::AND(uint8_t val)
+// SBC A, d8
+void gb::opDE()
 {
-	A &= val;
-	Zb = checkZero(A);
-	Nb = 0;
-	Hb = 1;
-	Cb = 0;
+	SUB(imm8, true);
+	PC += 2;
 }
 
-// XORs A with a value.
-void gb::XOR(uint8_t val)
+// RST 18H
+void gb::opDF()
 {
-	A ^= val;
-	Zb = checkZero(A);
-	Nb = 0;
-	Hb = 0;
-	Cb = 0;
+	RST(0x18);
 }
 
-// ORs A with a value.
-void gb::OR(uint8_t val)
+// LDH (a8), A
+void gb::opE0()
 {
-	A |= val;
-	Zb = checkZero(A);
-	Nb = 0;
-	Hb = 0;
-	Cb = 0;
+	writeToMemory(0xFF00 + imm8, A);
+	PC += 2;
 }
 
-// Sets the flags for a subtraction of an 8-bit value from A, without storing the result.
-void gb::CP(uint8_t val)
+// POP HL
+void gb::opE1()
 {
-	Cb = val > A;
-	Hb = checkHalfCarry(A, val, '-');
-	Zb = checkZero(A - val);
-	Nb = 1;
+	H = readMemory(SP + 1);
+	L = readMemory(SP);
+	SP += 2;
+	PC += 1;
 }
 
-// Rotate a byte left or right. Can rotate normally or through carry.
-void gb::ROT(char mode, bool carry, uint8_t &val)
+// LDH (C), A
+void gb::opE2()
 {
-	int oldCb = Cb;
+	writeToMemory(0xFF00 + C, A);
+	PC += 1;
+}
 
-	// Check which direction we are rotating in.
-	if (mode == 'L')
-	{
-		Cb = (val >> 7) & 0x1; // New carry bit is the bit rotated out.
-		val <<= 1;             // Rotate left.
+// Unknown instruction.
+void gb::opE3()
+{
+	std::cerr << "Unknown instruction E3!\n";
+	PC += 1;
+}
 
-		// If rotating through carry, set the rightmost bit to the old carry bit value.
-		if (carry)
-			modifyBit(val, oldCb, 0);
+// Unknown instruction.
+void gb::opE4()
+{
+	std::cerr << "Unknown instruction E4!\n";
+	PC += 1;
+}
 
-		// If not rotating through carry, we set the rightmost bit to the bit rotated out (same as carry bit).
-		else
-			modifyBit(val, Cb, 0);
-	}
+// PUSH HL
+void gb::opE5()
+{
+	writeToMemory(SP - 1, H);
+	writeToMemory(SP - 2, L);
+	SP -= 2;
+	PC += 1;
+}
 
-	// Similar procedure when rotating right.
-	else if (mode == 'R')
-	{
-		Cb = val & 0x1;
-		val >>= 1;
+// AND d8
+void gb::opE6()
+{
+	AND(imm8);
+	PC += 2;
+}
 
-		if (carry)
-			modifyBit(val, oldCb, 7);
+// RST 20H
+void gb::opE7()
+{
+	RST(0x20);
+}
 
-		else
-			modifyBit(val, Cb, 7);
-	}
+// ADD SP, r8
+void gb::opE8()
+{
+	ADD(SP, static_cast<int8_t>(imm8));
+	PC += 2;
+}
 
-	Zb = checkZero(val);
-	Nb = 0;
-	Hb = 0;
+// JP HL
+void gb::opE9()
+{
+	PC = HL;
 }
 
-// Shift a bit left or right, or right logically.
-void gb::SHIFT(char mode, uint8_t &r)
+// LD (a16), A
+void gb::opEA()
 {
+	writeToMemory(imm16, A);
+	PC += 3;
+}
 
-	// Check which direction we are shifting.
-	if (mode == 'L')
-	{
-		// Get the carry bit and shift left.
-		Cb = (r >> 7) & 0x1;
-		r <<= 1;
-	}
+// Unknown instruction.
+void gb::opEB()
+{
+	std::cerr << "Unknown instruction EB!\n";
+	PC += 1;
+}
 
-	else if (mode == 'R')
-	{
-		// Get the carry bit and shift right.
-		Cb = r & 0x1;
-		r >>= 1;
+// Unknown instruction.
+void gb::opEC()
+{
+	std::cerr << "Unknown instruction EC!\n";
+	PC += 1;
+}
 
-		// The 7th bit's value is retained after the shift, so set it to the 6th bit's value.
-		modifyBit(r, (r >> 6) & 0x1, 7);
-	}
+// Unknown instruction.
+void gb::opED()
+{
+	std::cerr << "Unknown instruction ED!\n";
+	PC += 1;
+}
 
-	// Can also shift right logically.
-	else if (mode == 'l')
-	{
-		Cb = r & 0x1;
-		r >>= 1;
-	}
+// XOR d8
+void gb::opEE()
+{
+	XOR(imm8);
+	PC += 2;
+}
 
-	Zb = checkZero(r);
-	Nb = 0;
-	Hb = 0;
+// RST 28H
+void gb::opEF()
+{
+	RST(0x28);
 }
 
-// Checks the value of a given bit in a byte, and sets the zero flag if it is zero.
-void gb::BIT(int pos, uint8_t r)
+// LDH A, (a8)
+void gb::opF0()
 {
-	uint8_t bit = (r >> pos) & 0x1;
-	if (bit == 0)
-		Zb = 1;
-	else
-		Zb = 0;
-	Nb = 0;
-	Hb = 1;
+	A = readMemory(0xFF00 + imm8);
+	PC += 2;
 }
 
-// Swaps the upper and lower nibbles of a byte.
-void gb::SWAP(uint8_t &val)
+// POP AF
+void gb::opF1()
 {
-	val = val << 4 | val >> 4;
-	Zb = checkZero(val);
-	Nb = 0;
-	Hb = 0;
-	Cb = 0;
+	A = readMemory(SP + 1);
+	setF(readMemory(SP));
+	SP += 2;
+	PC += 1;
 }
 
-// Calls the next address in memory.
-void gb::CALL()
+// LDH A, (C)
+void gb::opF2()
 {
-	// Push the next instruction onto the stack.
-	writeToMemory(SP - 1, (PC + 3) >> 8);
-	writeToMemory(SP - 2, (PC + 3) & 0xFF);
-	SP -= 2;
+	A = readMemory(0xFF00 + C);
+	PC += 1;
+}
 
-	// Jump to the address.
-	PC = (memory[PC + 2] << 8) | memory[PC + 1];
+// DI
+void gb::opF3()
+{
+	DI();
+	PC += 1;
 }
 
-// Calls the given address.
-void gb::RST(uint8_t vec)
+// Unknown instruction.
+void gb::opF4()
 {
+	std::cerr << "Unknown instruction F4!\n";
 	PC += 1;
-	writeToMemory(SP - 1, PC >> 8);
-	writeToMemory(SP - 2, PC & 0xFF);
+}
+
+// PUSH AF
+void gb::opF5()
+{
+	F = getF();
+	writeToMemory(SP - 1, A);
+	writeToMemory(SP - 2, F);
 	SP -= 2;
-	PC = vec;
+	PC += 1;
 }
 
-// Enable interrupts.
-void gb::EI()
+// OR d8
+void gb::opF6()
 {
-	IME = true;
-	scheduleIME = false;
-	cyclesBeforeEnableIME = 1;
+	OR(imm8);
+	PC += 2;
 }
 
-// Disable interrupts.
-void gb::DI()	
+// RST 30H
+void gb::opF7()
+{
+	RST(0x30);
+}
+
+// LD HL, SP + r8
+void gb::opF8()
+{
+	int16_t val = imm8;
+	uint16_t tempSP = SP;
+	ADD(tempSP, static_cast<int8_t>(val));
+	HL = tempSP;
+	PC += 2;
+}
+
+// LD SP, HL
+void gb::opF9()
+{
+	SP = HL;
+	PC += 1;
+}
+
+// LD A, (a16)
+void gb::opFA()
+{
+	uint16_t addr = imm16;
+	A = readMemory(addr);
+	PC += 3;
+}
+
+// EI
+void gb::opFB()
 {
-	IME = false;
-	scheduleIME = false;
 	cyclesBeforeEnableIME = 1;
-}
\ No newline at end of file
+	scheduleIME = true;
+	PC += 1;
+}
+
+// Unknown instruction.
+void gb::opFC()
+{
+	std::cerr << "Unknown instruction FC!\n";
+	PC += 1;
+}
+
+// Unknown instruction.
+void gb::opFD()
+{
+	std::cerr << "Unknown instruction FD!\n";
+	PC += 1;
+}
+
+// CP d8
+void gb::opFE()
+{
+	CP(imm8);
+	PC += 2;
+}
+
+// RST 38H
+void gb::opFF()
+{
+	RST(0x38);
+}
@@ -4,8 +4,34 @@
 #include <stdio.h>
 #include <cstdint>
 
+// Byte order of the host, used to lay out the register pairs so that each 16-bit pair overlaps its
+// high and low 8-bit registers.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define GB_BIG_ENDIAN 1
+#else
+#define GB_BIG_ENDIAN 0
+#endif
+
+// Defining GB_THREADED makes runUntil() use an interpreter loop dispatched through computed gotos,
+// which only GCC and Clang support. Other compilers and builds without it use the dispatch table.
+#if defined(GB_THREADED) && !defined(__GNUC__)
+#undef GB_THREADED
+#endif
+
+// Lists every opcode from 00 to FF, passing each to the macro m as two hex digits.
+#define GB_OPCODE_ROW(m, h) \
+	m(h##0) m(h##1) m(h##2) m(h##3) m(h##4) m(h##5) m(h##6) m(h##7) \
+	m(h##8) m(h##9) m(h##A) m(h##B) m(h##C) m(h##D) m(h##E) m(h##F)
+#define GB_ALL_OPCODES(m) \
+	GB_OPCODE_ROW(m, 0) GB_OPCODE_ROW(m, 1) GB_OPCODE_ROW(m, 2) GB_OPCODE_ROW(m, 3) \
+	GB_OPCODE_ROW(m, 4) GB_OPCODE_ROW(m, 5) GB_OPCODE_ROW(m, 6) GB_OPCODE_ROW(m, 7) \
+	GB_OPCODE_ROW(m, 8) GB_OPCODE_ROW(m, 9) GB_OPCODE_ROW(m, A) GB_OPCODE_ROW(m, B) \
+	GB_OPCODE_ROW(m, C) GB_OPCODE_ROW(m, D) GB_OPCODE_ROW(m, E) GB_OPCODE_ROW(m, F)
+
 // Named registers in memory.
 constexpr uint16_t JOYP = 0xFF00;
+constexpr uint16_t SB = 0xFF01;
+constexpr uint16_t SC = 0xFF02;
 constexpr uint16_t DIV = 0xFF04;
 constexpr uint16_t TIMA = 0xFF05;
 constexpr uint16_t TMA = 0xFF06;
@@ -24,28 +50,155 @@ constexpr uint16_t WY = 0xFF4A;
 constexpr uint16_t WX = 0xFF4B;
 constexpr uint16_t IE = 0xFFFF;
 
+struct sharedRom;
+struct mappedSave;
+
 class gb
 {
 public:
 	void initialize();														
 	void loadGame(char filename[], char* gameTitle);						
-	void emulateCycle();													
+	int emulateCycle();														
+
+	// Reasons for runUntil() to return. It takes any combination of them other than STOP_CYCLES, which
+	// it returns when the cycle limit is reached first.
+	enum stopReason { STOP_CYCLES = 0x00, STOP_FRAME = 0x01, STOP_LINE = 0x02, STOP_BREAKPOINT = 0x04, STOP_HALT = 0x08, STOP_SERIAL = 0x10, STOP_WATCHPOINT = 0x20 };
+	stopReason runUntil(int stopAt, uint64_t maxCycles);
+	stopReason runCycles(uint64_t n);
+	stopReason runFrame();
+	void setBreakpoint(uint16_t addr, bool set);
+	void setWatchpoint(uint16_t addr, bool set);
+	enum joypadButton { JOYPAD_RIGHT = 0x01, JOYPAD_LEFT = 0x02, JOYPAD_UP = 0x04, JOYPAD_DOWN = 0x08, JOYPAD_A = 0x10, JOYPAD_B = 0x20, JOYPAD_SELECT = 0x40, JOYPAD_START = 0x80 };
+	void setJoypad(uint8_t pressed);
+	void flushSave(bool wait);
+#ifdef GB_PROFILE_PAIRS
+	void printPairProfile(int count);
+	uint32_t pairCounts[0x10000] = {};										// Times each opcode (high byte) was run before another (low byte).
+#endif
+	~gb();
 	void modifyBit(uint8_t &r, int val, int pos);						
 
 	uint8_t memory[65536];													// 2^16 bytes can be addressed.
-	bool logging = false;													// Set to log CPU state to output.txt.
+	bool logging = false;													// Set to log CPU state to output.txt. Ignored if built with GB_NO_TRACE.
+	bool lineReady = false;													// Set when the PPU reaches HBLANK on a visible line (LY). Cleared by the frontend.
+	bool frameReady = false;												// Set when the PPU enters VBLANK. Cleared by the frontend.
+	uint8_t serialByte = 0xFF;												// Last byte sent through the serial port.
+	uint16_t watchAddress = 0;												// Address written when runUntil() last stopped for STOP_WATCHPOINT.
+	enum cpuBackend { INTERPRETER, CACHED, JIT };
+	bool idleLoopSkipping = true;											// Set to false to run polling loops instruction by instruction.
+	cpuBackend backend = INTERPRETER;										// Set to CACHED to run ROM from pre-decoded instructions, or JIT to also compile hot blocks to x86-64.
+	bool saveBattery = true;												// Set to false before loadGame() to keep battery-backed RAM out of the .sav file.
+	bool rtcHostTime = true;												// Set to false before loadGame() to run the MBC3 clock from emulated time, for repeatable runs.
+	int saveInterval = 60;													// Frames between writes of battery-backed RAM to the .sav file, or 0 to only write it on exit.
 
 private:
 	// General functions.
-	void incTimer();
-	void updateFlagReg();													
-	bool checkHalfCarry(uint8_t val1, uint8_t val2, char mode);
-	bool checkHalfCarry(uint16_t val1, uint16_t val2, char mode);
-	bool checkZero(uint8_t a);
-	uint16_t combineReg(uint8_t r1, uint8_t r2);
-	void splitReg(uint8_t &r1, uint8_t &r2, uint16_t r3);
+	template <bool trace> int runInstruction();
+	void traceInstruction();
+#ifdef GB_THREADED
+	template <bool trace> void runThreaded(uint64_t end);
+	bool runEventsForThreaded();
+#endif
+	void requestInterrupt(int bit);
+	void updateInterrupts();
+	void updateTima();
+	uint8_t readJoypad();
+	bool getH();
+	uint8_t getF();
+	void setF(uint8_t val);
+	void setHalfCarry(uint8_t op, uint16_t x, uint16_t y, uint8_t carryIn);
 	void writeToMemory(uint16_t addr, uint8_t data);
 
+	// Memory map. Every 256-byte page of the address space has a host pointer for reads and one for
+	// writes, so most accesses are a table lookup and a load or store. Pages whose pointer is null go
+	// through readIO() or writeIO() instead.
+	const uint8_t* readPages[256];
+	uint8_t* writePages[256];
+	void mapPage(int page);
+	void mapMemory();
+	bool isDmaBusPage(int page);
+
+	// Write watching. Writes to a page with anything watched in it go through writeIO(), which checks
+	// them against compiled code and watchpoints. Every other page keeps its direct write pointer.
+	enum pageWatch { WATCH_CODE = 0x1, WATCH_DATA = 0x2 };
+	void setPageWatch(uint8_t page, uint8_t reason, bool set);
+	void checkWatchedWrite(uint16_t addr);
+	uint8_t readMemory(uint16_t addr);
+	void fetchInstruction();
+	uint8_t readIO(uint16_t addr);
+	void writeIO(uint16_t addr, uint8_t data);
+
+	// Cartridge, see cartridge.cpp. The memory map points into the ROM image and cartridge RAM, so
+	// switching banks only changes page pointers.
+	enum mbcType { MBC_NONE, MBC1, MBC3, MBC5 };
+	void setUpCartridge(const char* filename);
+	void resetMbc();
+	void writeMbc(uint16_t addr, uint8_t data);
+	void updateBanks();
+	void releaseCartRam();
+	uint64_t rtcClock();
+	void updateRtc();
+	void getRtcRegisters(uint8_t registers[5]);
+	void latchRtc();
+	void writeRtc(int reg, uint8_t data);
+	void loadRtc();
+	void storeRtc();
+	void releaseCartridge();
+	bool openRom(const char* filename);
+	void closeRom();
+	void openBlankRom();
+
+	// Event scheduler. Pending events are kept in a binary min-heap ordered by the cycle they are due on,
+	// so the CPU loop only needs to compare the counter against the earliest deadline.
+	enum eventType { TIMER_EVENT, PPU_EVENT, DMA_EVENT, SERIAL_EVENT, EVENT_COUNT };
+	struct scheduledEvent
+	{
+		uint64_t when;
+		eventType type;
+	};
+	void scheduleEvent(eventType type, uint64_t when);
+	void cancelEvent(eventType type);
+	void siftEventUp(int pos);
+	void siftEventDown(int pos);
+	void swapEvents(int a, int b);
+	void runEvents();
+	void updateTimerEvent();
+
+	// Idle loop skipping. A snapshot of the CPU is taken at each jump backwards.
+	struct idleLoopState
+	{
+		bool valid;
+		bool IME;
+		uint8_t A, F;
+		uint16_t BC, DE, HL, SP, PC;
+		uint64_t counter;
+	};
+	int skipIdleLoop();
+	int findIdleLoopReads(uint16_t start, uint16_t reads[4]);
+
+	// PPU timing.
+	void ppuEvent(uint64_t when);
+	void startLine(uint64_t when);
+	void setPpuMode(uint8_t mode);
+
+	// Block compiler, see jit.cpp.
+	struct jitBlock
+	{
+		const uint8_t* code;												// Compiled code for the instruction, or null if it hasn't been compiled.
+		uint16_t hits;														// Times the block was reached before being compiled.
+	};
+	int runJitBlock();
+	jitBlock& findJitBlock(uint16_t addr);
+	bool compileJitBlock(uint16_t addr);
+	void invalidateJitPage(uint8_t page);
+	void flushJit();
+	void releaseJit();
+	typedef void (*jitHandler)(gb* self);
+	template <void (gb::*handler)()> static void jitThunk(gb* self);
+	static const jitHandler jitThunks[256];
+	static uint8_t jitReadIO(gb* self, uint16_t addr);
+	static void jitWriteIO(gb* self, uint16_t addr, uint8_t data);
+
 	// Implementations of some opcodes. Capitalised as some names are keywords in C++ e.g. xor.
 	void INC(uint8_t &r);												
 	void INC(uint16_t &val);
@@ -59,8 +212,13 @@ private:
 	void XOR(uint8_t val);
 	void OR(uint8_t val);
 	void CP(uint8_t val);
-	void ROT(char dir, bool carry, uint8_t &r);
-	void SHIFT(char dir, uint8_t &r);
+	void RLC(uint8_t &val);
+	void RRC(uint8_t &val);
+	void RL(uint8_t &val);
+	void RR(uint8_t &val);
+	void SLA(uint8_t &val);
+	void SRA(uint8_t &val);
+	void SRL(uint8_t &val);
 	void BIT(int pos, uint8_t r);
 	void SWAP(uint8_t &val);
 	void CALL();
@@ -68,16 +226,157 @@ private:
 	void EI();
 	void DI();
 
+	// Instruction handlers, one per opcode. cbOp<N> implements the CB-prefixed instruction N.
+	typedef void (gb::*opHandler)();
+	static const opHandler opTable[256];
+	static const opHandler cbTable[256];
+	static const uint8_t opCycles[256];
+	static const uint8_t cbCycles[256];
+	static const uint8_t opLengths[256];
+	void op00(); void op01(); void op02(); void op03(); void op04(); void op05(); void op06(); void op07(); void op08(); void op09(); void op0A(); void op0B(); void op0C(); void op0D(); void op0E(); void op0F();
+	void op10(); void op11(); void op12(); void op13(); void op14(); void op15(); void op16(); void op17(); void op18(); void op19(); void op1A(); void op1B(); void op1C(); void op1D(); void op1E(); void op1F();
+	void op20(); void op21(); void op22(); void op23(); void op24(); void op25(); void op26(); void op27(); void op28(); void op29(); void op2A(); void op2B(); void op2C(); void op2D(); void op2E(); void op2F();
+	void op30(); void op31(); void op32(); void op33(); void op34(); void op35(); void op36(); void op37(); void op38(); void op39(); void op3A(); void op3B(); void op3C(); void op3D(); void op3E(); void op3F();
+	void op40(); void op41(); void op42(); void op43(); void op44(); void op45(); void op46(); void op47(); void op48(); void op49(); void op4A(); void op4B(); void op4C(); void op4D(); void op4E(); void op4F();
+	void op50(); void op51(); void op52(); void op53(); void op54(); void op55(); void op56(); void op57(); void op58(); void op59(); void op5A(); void op5B(); void op5C(); void op5D(); void op5E(); void op5F();
+	void op60(); void op61(); void op62(); void op63(); void op64(); void op65(); void op66(); void op67(); void op68(); void op69(); void op6A(); void op6B(); void op6C(); void op6D(); void op6E(); void op6F();
+	void op70(); void op71(); void op72(); void op73(); void op74(); void op75(); void op76(); void op77(); void op78(); void op79(); void op7A(); void op7B(); void op7C(); void op7D(); void op7E(); void op7F();
+	void op80(); void op81(); void op82(); void op83(); void op84(); void op85(); void op86(); void op87(); void op88(); void op89(); void op8A(); void op8B(); void op8C(); void op8D(); void op8E(); void op8F();
+	void op90(); void op91(); void op92(); void op93(); void op94(); void op95(); void op96(); void op97(); void op98(); void op99(); void op9A(); void op9B(); void op9C(); void op9D(); void op9E(); void op9F();
+	void opA0(); void opA1(); void opA2(); void opA3(); void opA4(); void opA5(); void opA6(); void opA7(); void opA8(); void opA9(); void opAA(); void opAB(); void opAC(); void opAD(); void opAE(); void opAF();
+	void opB0(); void opB1(); void opB2(); void opB3(); void opB4(); void opB5(); void opB6(); void opB7(); void opB8(); void opB9(); void opBA(); void opBB(); void opBC(); void opBD(); void opBE(); void opBF();
+	void opC0(); void opC1(); void opC2(); void opC3(); void opC4(); void opC5(); void opC6(); void opC7(); void opC8(); void opC9(); void opCA(); void opCB(); void opCC(); void opCD(); void opCE(); void opCF();
+	void opD0(); void opD1(); void opD2(); void opD3(); void opD4(); void opD5(); void opD6(); void opD7(); void opD8(); void opD9(); void opDA(); void opDB(); void opDC(); void opDD(); void opDE(); void opDF();
+	void opE0(); void opE1(); void opE2(); void opE3(); void opE4(); void opE5(); void opE6(); void opE7(); void opE8(); void opE9(); void opEA(); void opEB(); void opEC(); void opED(); void opEE(); void opEF();
+	void opF0(); void opF1(); void opF2(); void opF3(); void opF4(); void opF5(); void opF6(); void opF7(); void opF8(); void opF9(); void opFA(); void opFB(); void opFC(); void opFD(); void opFE(); void opFF();
+	template <int N> void cbOp();
+	uint8_t& cbRegister(int r);
+
 	FILE* pFile;															// Pointer for log file.
 	uint8_t opcode;
-	uint8_t A, B, C, D, E, F, H, L;											// CPU registers.
+
+	// Instructions in ROM, decoded for the cached interpreter a bank at a time, the first time code in
+	// the bank runs. An entry holds everything needed to run the instruction at that address without
+	// reading memory.
+	struct decodedInstruction
+	{
+		opHandler handler;
+		uint16_t imm16;
+		uint8_t cycles;
+	};
+	const decodedInstruction* findDecodedInstruction(uint16_t addr);
+	void decodeBank(int window);
+	void clearDecodedRom();
+
+	// Pairs of instructions that are common enough to run as one superinstruction in the cached
+	// interpreter.
+	struct fusedPair
+	{
+		uint8_t first;
+		uint8_t second;
+		opHandler handler;
+	};
+	static const fusedPair fusedPairs[9];
+	template <opHandler first, opHandler second> void fusedOp();
+#ifdef GB_PROFILE_PAIRS
+	uint8_t previousOpcode = 0;
+#endif
+
+	// CPU registers. Each pair shares storage with its two 8-bit registers, so AF, BC, DE and HL can be
+	// used directly as 16-bit registers without combining or splitting the halves. imm16 holds the two
+	// bytes after the opcode, fetched before the handler runs, and imm8 the first of them.
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable: 4201)												// Nameless struct/union.
+#endif
+#if GB_BIG_ENDIAN
+	union { uint16_t AF; struct { uint8_t A, F; }; };
+	union { uint16_t BC; struct { uint8_t B, C; }; };
+	union { uint16_t DE; struct { uint8_t D, E; }; };
+	union { uint16_t HL; struct { uint8_t H, L; }; };
+	union { uint16_t imm16; struct { uint8_t immHigh, imm8; }; };
+#else
+	union { uint16_t AF; struct { uint8_t F, A; }; };
+	union { uint16_t BC; struct { uint8_t C, B; }; };
+	union { uint16_t DE; struct { uint8_t E, D; }; };
+	union { uint16_t HL; struct { uint8_t L, H; }; };
+	union { uint16_t imm16; struct { uint8_t imm8, immHigh; }; };
+#endif
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
 	uint16_t SP, PC;														// Stack pointer and program counter.
-	uint16_t HL, BC, DE;													// Some registers can be combined.
-	uint8_t Zb, Nb, Hb, Cb;													// Store flag register values.
+	uint8_t Nb, Cb;															// Store flag register values. Z and H are evaluated lazily.
+	uint8_t zeroResult;														// Result of the last operation that set Z. Z is set when this is zero.
+	enum halfCarryOp { HALF_ADD, HALF_SUB, HALF_ADD16, HALF_SET };
+	uint8_t halfOp;															// How H is worked out from the operands below (a halfCarryOp).
+	uint16_t halfX, halfY;													// Operands of the last operation that set H, or H itself for HALF_SET.
+	uint8_t halfCarryIn;													// Carry added or subtracted by that operation.
+	mbcType mbc = MBC_NONE;													// Memory bank controller on the cartridge.
+	const uint8_t* rom = nullptr;											// ROM image, padded to romBanks banks. Shared, so never written.
+	sharedRom* romFile = nullptr;											// Where rom came from, or null for the blank cartridge.
+	int romBanks = 0;														// Number of 16KB ROM banks, a power of two.
+	int romWindowBank[2] = { 0, 1 };										// ROM banks mapped at 0000-3FFF and 4000-7FFF.
+	uint8_t* cartRam = nullptr;												// Cartridge RAM, or null if there is none.
+	uint8_t* saveData = nullptr;											// Save file mapped into memory if the cartridge has a battery. Starts with cartRam.
+	mappedSave* saveFile = nullptr;											// Entry for saveData in the table of mapped saves, or null.
+	size_t saveSize = 0;													// Bytes at saveData.
+	int framesSinceSave = 0;												// Frames since saveData was last written back.
+	bool hasRtc = false;													// Set if the cartridge is an MBC3 with a clock.
+	int rtcRegister = -1;													// Clock register (0-4) mapped at A000-BFFF in place of RAM, or -1.
+	uint8_t rtcLatched[5];													// Clock registers as last latched, which is what the game reads.
+	uint64_t rtcSeconds;													// Clock time in seconds, days included, as of rtcUpdatedAt.
+	uint64_t rtcUpdatedAt;													// Reading of rtcClock() that rtcSeconds was last brought up to date on.
+	bool rtcHalted;															// Set if the game has stopped the clock.
+	bool rtcCarry;															// Set once the day counter has overflowed, until the game clears it.
+	uint8_t rtcLatchWrite;													// Last value written to 6000-7FFF.
+	uint8_t rtcPage[256];													// Reads of the clock register selected, all its latched value.
+	uint8_t* rtcSaveData = nullptr;											// Clock state in the save file, after the RAM, or null if it isn't saved.
+	int cartRamBanks = 0;													// Number of 8KB cartridge RAM banks, a power of two.
+	uint8_t* cartRamWindow = nullptr;										// Cartridge RAM bank mapped at A000-BFFF, or null if none is.
+	bool cartRamEnabled;													// Set if the game has enabled cartridge RAM.
+	int romBankRegister;													// ROM bank number written to the MBC (the low 5 bits on MBC1).
+	int ramBankRegister;													// RAM bank number written to the MBC (the high ROM bank bits on MBC1).
+	bool mbc1Mode;															// Set if MBC1 applies ramBankRegister to 0000-3FFF and RAM too.
+	uint8_t unmappedPage[256];												// Reads of cartridge RAM that isn't there or isn't enabled, all 0xFF.
+	decodedInstruction* decodedBanks[512] = {};								// Decoded instructions for each ROM bank, or null if it hasn't run.
+	decodedInstruction* decodedWindow[2] = {};								// Decoded instructions for each bank in romWindowBank.
 	bool IME;																// Flag to disable/enable interrupts.
+	bool interruptPending;													// Set if IME is set and an enabled interrupt is requested.
 	bool scheduleIME;														// Set if IME is scheduled to be enabled.
+	bool serialDone;														// Set when a serial transfer finishes, for STOP_SERIAL.
+	uint8_t breakpointBits[0x2000] = {};									// One bit per address, set for addresses set with setBreakpoint().
+	int breakpointCount = 0;												// Number of addresses set in breakpointBits.
+	uint8_t pageWatches[256] = {};											// Why writes to each page are watched, a combination of pageWatch.
+	uint8_t watchBits[0x2000] = {};											// One bit per address, set for addresses set with setWatchpoint().
+	uint16_t pageWatchpoints[256] = {};										// Number of watchpoints in each page.
+	int watchpointCount = 0;												// Number of watchpoints set.
+	bool watchHit = false;													// Set when a watchpoint is written to, for STOP_WATCHPOINT.
+	bool halted;															// Set while HALT waits for an interrupt.
+	idleLoopState idleLoop;													// CPU state the last time it jumped back to the start of a possible polling loop.
+	bool haltBug;															// Set if the next opcode is to be read twice, after HALT with IME off and an interrupt pending.
+	bool dmaActive = false;													// Set while an OAM DMA transfer runs.
+	uint8_t dmaSource = 0;													// Page the OAM DMA transfer copies from, with E0-FF folded onto C0-DF.
 	int cyclesBeforeEnableIME = 1;
 	uint8_t intVectors[5] = { 0x40, 0x48, 0x50, 0x58, 0x60 };				// Jump vectors for interrupts.
-	unsigned int counter;													// Counts the number of machine cycles passed.
+	uint64_t counter;														// Counts the number of machine cycles passed.
+	uint64_t divReset;														// Cycle DIV was last reset on.
+	uint64_t timaUpdatedAt;													// Cycle TIMA in memory was last brought up to date on.
+	uint8_t joypad;															// Buttons held down, a combination of joypadButton.
+	int cycles;																// Machine cycles taken by the current instruction.
+	const unsigned int timerPeriods[4] = { 256, 4, 16, 64 };				// Machine cycles per TIMA increment for each TAC clock select.
+	scheduledEvent eventHeap[EVENT_COUNT];									// Pending events, earliest first.
+	int eventHeapPos[EVENT_COUNT];											// Position of each event type in the heap, or -1 if not scheduled.
+	int eventCount;															// Number of pending events.
+	uint64_t nextEventAt;													// Cycle the earliest pending event is due on.
+	static constexpr uint64_t jitMinRun = 8;								// Fewest machine cycles before the next event worth entering a block for.
+	uint8_t* jitCode = nullptr;												// Executable buffer holding compiled blocks.
+	size_t jitCodeUsed = 0;													// Bytes of the buffer in use.
+	size_t jitCodeReserved;													// Bytes at the start of the buffer used to enter and leave blocks.
+	const uint8_t* jitEpilogue;												// Code that returns from a block.
+	jitBlock* jitBlocks = nullptr;											// Compiled code for each instruction address in RAM.
+	jitBlock* jitRomBlocks[2][512] = {};									// Compiled code for each instruction in each ROM bank, by the window it ran in.
+	uint8_t jitPageRewrites[0x100] = {};									// Times compiled code in each page of RAM has been written over.
+	bool jitExit;															// Set to make a running block return after the current instruction.
 };
-#endif GB_H
\ No newline at end of file
+#endif // GB_H
\ No newline at end of file
@@ -0,0 +1,850 @@
+#include "gb.h"
+
+// The JIT translates basic blocks of Game Boy code into x86-64 machine code. Loads, stores, 8-bit
+// arithmetic, increments and jumps are compiled to native code working on the registers and flags in
+// the gb object. Reads and writes go through the page tables inline, and only call into readIO() or
+// writeIO() for pages without a pointer. Every other instruction becomes a call to its handler. Each
+// instruction adds its cycles to the counter, which is kept in a register, and the block is left before
+// the next instruction if an event is due, so the opcode fetch, dispatch table lookup and interrupt
+// checks of the interpreter loop are paid once per block rather than once per instruction. Events still
+// run on the same instruction boundaries as in the interpreter, and a block left early is re-entered
+// part way through, as every instruction in a block is an entry point. Blocks that run or jump into an
+// already compiled instruction in the same page go straight to it, so a loop runs without leaving the
+// compiled code, unless it is a polling loop that skipIdleLoop() could skip. Blocks are only compiled
+// for ROM, work RAM and high RAM, once they have been reached jitThreshold times. On other
+// architectures every block is left to the interpreter.
+#if defined(_M_X64) || defined(__x86_64__)
+#define GB_JIT_X64 1
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+constexpr int jitThreshold = 16;									// Times a block must be reached before it is compiled.
+constexpr int jitMaxBackoff = 10;									// Most times jitThreshold is doubled for code that keeps being rewritten.
+constexpr int jitMaxInstructions = 32;								// Longest block that will be compiled.
+constexpr size_t jitBufferSize = 4 << 20;							// Bytes of executable memory for compiled blocks.
+constexpr size_t jitMaxBlockSize = 64 + jitMaxInstructions * 320;	// Upper bound on the code emitted for one block.
+constexpr size_t jitPageSize = 4096;								// Size of the pages memory protection applies to.
+
+// Checks if code at an address can be compiled. Code in VRAM, cartridge RAM, OAM or I/O always runs
+// in the interpreter.
+static bool isJitRegion(int addr)
+{
+	return addr < 0x8000 || (addr >= 0xC000 && addr < 0xE000) || (addr >= 0xFF80 && addr < 0xFFFF);
+}
+
+// Checks if an instruction ends a block: anything that can jump, changes IME, halts, or is unknown.
+static bool endsBlock(uint8_t op)
+{
+	switch (op)
+	{
+	case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: case 0x76:
+	case 0xC0: case 0xC2: case 0xC3: case 0xC4: case 0xC7: case 0xC8: case 0xC9: case 0xCA: case 0xCC: case 0xCD: case 0xCF:
+	case 0xD0: case 0xD2: case 0xD3: case 0xD4: case 0xD7: case 0xD8: case 0xD9: case 0xDA: case 0xDB: case 0xDC: case 0xDD: case 0xDF:
+	case 0xE3: case 0xE4: case 0xE7: case 0xE9: case 0xEB: case 0xEC: case 0xED: case 0xEF:
+	case 0xF3: case 0xF4: case 0xF7: case 0xFB: case 0xFC: case 0xFD: case 0xFF:
+		return true;
+	default:
+		return false;
+	}
+}
+
+#ifdef GB_JIT_X64
+// Where compiled code finds what it uses: offsets of members from the gb pointer it keeps in rbx, and
+// the functions it calls for memory without a page pointer.
+struct jitLayout
+{
+	int32_t registers[8];												// B, C, D, E, H, L, none for (HL), then A, as numbered in opcodes.
+	int32_t BC, DE, HL, SP, PC;
+	int32_t zeroResult, Nb, Cb, halfOp, halfX, halfY, halfCarryIn;
+	int32_t counter, nextEventAt, cycles, imm16, jitExit, idleLoopValid, readPages, writePages;
+	uint64_t readIO, writeIO;
+	uint8_t halfAdd, halfSub, halfSet;									// Values of halfOp.
+};
+
+// Registers as numbered in the reg field of a ModRM byte.
+enum { EAX, ECX, EDX };
+
+// Writes a little-endian value to the code buffer.
+static void emitValue(uint8_t*& p, uint64_t val, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		*p++ = static_cast<uint8_t>(val >> (i * 8));
+}
+
+// Writes an instruction addressing a member of gb through rbx, i.e. op [rbx + disp32].
+static void emitMember(uint8_t*& p, uint8_t rex, uint8_t op, uint8_t modrm, int32_t disp)
+{
+	if (rex)
+		*p++ = rex;
+	*p++ = op;
+	*p++ = modrm;
+	emitValue(p, static_cast<uint32_t>(disp), 4);
+}
+
+// Writes a jump to a location in the code buffer.
+static void emitJump(uint8_t*& p, uint8_t op1, uint8_t op2, const uint8_t* target)
+{
+	*p++ = op1;
+	if (op2)
+		*p++ = op2;
+	emitValue(p, static_cast<uint32_t>(target - (p + 4)), 4);
+}
+
+// Writes a jump whose target isn't known yet, and returns where to patch it with patchJump().
+static uint8_t* emitForwardJump(uint8_t*& p, uint8_t op1, uint8_t op2)
+{
+	*p++ = op1;
+	if (op2)
+		*p++ = op2;
+	p += 4;
+	return p - 4;
+}
+
+// Points a jump written by emitForwardJump() at a location.
+static void patchJump(uint8_t* at, const uint8_t* target)
+{
+	emitValue(at, static_cast<uint32_t>(target - (at + 4)), 4);
+}
+
+// Loads a byte or 16-bit member into a register, zero-extended: movzx reg, [rbx + disp].
+static void emitLoadByte(uint8_t*& p, int reg, int32_t disp)
+{
+	*p++ = 0x0F;
+	emitMember(p, 0, 0xB6, 0x83 | reg << 3, disp);
+}
+
+static void emitLoadWord(uint8_t*& p, int reg, int32_t disp)
+{
+	*p++ = 0x0F;
+	emitMember(p, 0, 0xB7, 0x83 | reg << 3, disp);
+}
+
+// Stores the low byte or 16 bits of a register in a member: mov [rbx + disp], reg.
+static void emitStoreByte(uint8_t*& p, int reg, int32_t disp)
+{
+	emitMember(p, 0, 0x88, 0x83 | reg << 3, disp);
+}
+
+static void emitStoreWord(uint8_t*& p, int reg, int32_t disp)
+{
+	*p++ = 0x66;
+	emitMember(p, 0, 0x89, 0x83 | reg << 3, disp);
+}
+
+// Sets a byte or 16-bit member to a constant: mov [rbx + disp], val.
+static void emitSetByte(uint8_t*& p, int32_t disp, uint8_t val)
+{
+	emitMember(p, 0, 0xC6, 0x83, disp);
+	*p++ = val;
+}
+
+static void emitSetWord(uint8_t*& p, int32_t disp, uint16_t val)
+{
+	*p++ = 0x66;
+	emitMember(p, 0, 0xC7, 0x83, disp);
+	emitValue(p, val, 2);
+}
+
+// Adds 1 to or subtracts 1 from a 16-bit member: add or sub word [rbx + disp], 1.
+static void emitStepWord(uint8_t*& p, int32_t disp, bool down)
+{
+	*p++ = 0x66;
+	emitMember(p, 0, 0x83, down ? 0xAB : 0x83, disp);
+	*p++ = 0x01;
+}
+
+// Adds a constant number of cycles to the counter in r12.
+static void emitAddCycles(uint8_t*& p, int cycles)
+{
+	*p++ = 0x49; *p++ = 0x83; *p++ = 0xC4;						// add r12, cycles
+	*p++ = static_cast<uint8_t>(cycles);
+}
+
+// Calls a function, passing the gb pointer as the first argument. Any other arguments are already in
+// place.
+static void emitCall(uint8_t*& p, uint64_t function)
+{
+#ifdef _WIN32
+	*p++ = 0x48; *p++ = 0x89; *p++ = 0xD9;						// mov rcx, rbx
+#else
+	*p++ = 0x48; *p++ = 0x89; *p++ = 0xDF;						// mov rdi, rbx
+#endif
+	*p++ = 0x48; *p++ = 0xB8;									// mov rax, function
+	emitValue(p, function, 8);
+	*p++ = 0xFF; *p++ = 0xD0;									// call rax
+}
+
+// Reads the byte at the address in ecx into eax, through readIO() if its page has no pointer. The
+// counter is stored first, as reading DIV or TIMA depends on it.
+static void emitRead(uint8_t*& p, const jitLayout& m)
+{
+	*p++ = 0x89; *p++ = 0xCA;									// mov edx, ecx
+	*p++ = 0xC1; *p++ = 0xEA; *p++ = 0x08;						// shr edx, 8
+	*p++ = 0x48; *p++ = 0x8B; *p++ = 0x94; *p++ = 0xD3;			// mov rdx, [rbx + rdx * 8 + readPages]
+	emitValue(p, static_cast<uint32_t>(m.readPages), 4);
+	*p++ = 0x48; *p++ = 0x85; *p++ = 0xD2;						// test rdx, rdx
+	uint8_t* slow = emitForwardJump(p, 0x0F, 0x84);				// jz slow
+	*p++ = 0x0F; *p++ = 0xB6; *p++ = 0xC9;						// movzx ecx, cl
+	*p++ = 0x0F; *p++ = 0xB6; *p++ = 0x04; *p++ = 0x0A;			// movzx eax, byte [rdx + rcx]
+	uint8_t* done = emitForwardJump(p, 0xE9, 0);				// jmp done
+	patchJump(slow, p);
+	emitMember(p, 0x4C, 0x89, 0xA3, m.counter);					// mov [rbx + counter], r12
+#ifdef _WIN32
+	*p++ = 0x89; *p++ = 0xCA;									// mov edx, ecx
+#else
+	*p++ = 0x89; *p++ = 0xCE;									// mov esi, ecx
+#endif
+	emitCall(p, m.readIO);
+	*p++ = 0x0F; *p++ = 0xB6; *p++ = 0xC0;						// movzx eax, al
+	patchJump(done, p);
+}
+
+// Writes al to the address in ecx, through writeIO() if its page has no pointer. Watched pages never
+// have one, so writes to compiled code and watchpoints always take the slow path, which can set jitExit
+// and schedule events.
+static void emitWrite(uint8_t*& p, const jitLayout& m)
+{
+	*p++ = 0x89; *p++ = 0xCA;									// mov edx, ecx
+	*p++ = 0xC1; *p++ = 0xEA; *p++ = 0x08;						// shr edx, 8
+	*p++ = 0x48; *p++ = 0x8B; *p++ = 0x94; *p++ = 0xD3;			// mov rdx, [rbx + rdx * 8 + writePages]
+	emitValue(p, static_cast<uint32_t>(m.writePages), 4);
+	*p++ = 0x48; *p++ = 0x85; *p++ = 0xD2;						// test rdx, rdx
+	uint8_t* slow = emitForwardJump(p, 0x0F, 0x84);				// jz slow
+	*p++ = 0x0F; *p++ = 0xB6; *p++ = 0xC9;						// movzx ecx, cl
+	*p++ = 0x88; *p++ = 0x04; *p++ = 0x0A;						// mov [rdx + rcx], al
+	emitSetByte(p, m.idleLoopValid, 0);							// mov byte [rbx + idleLoop.valid], 0
+	uint8_t* done = emitForwardJump(p, 0xE9, 0);				// jmp done
+	patchJump(slow, p);
+	emitMember(p, 0x4C, 0x89, 0xA3, m.counter);					// mov [rbx + counter], r12
+#ifdef _WIN32
+	*p++ = 0x41; *p++ = 0x89; *p++ = 0xC0;						// mov r8d, eax
+	*p++ = 0x89; *p++ = 0xCA;									// mov edx, ecx
+#else
+	*p++ = 0x89; *p++ = 0xC2;									// mov edx, eax
+	*p++ = 0x89; *p++ = 0xCE;									// mov esi, ecx
+#endif
+	emitCall(p, m.writeIO);
+	emitMember(p, 0x4C, 0x8B, 0xAB, m.nextEventAt);				// mov r13, [rbx + nextEventAt]
+	patchJump(done, p);
+}
+
+// Works out an 8-bit ALU operation (the reg field of opcodes 80-BF) on A and ecx, setting the flags as
+// ADD(), SUB(), AND(), XOR(), OR() and CP() do.
+static void emitAlu(uint8_t*& p, const jitLayout& m, int operation)
+{
+	const int32_t A = m.registers[7];
+	emitLoadByte(p, EAX, A);
+	if (operation < 4 || operation == 7)
+	{
+		// ADD, ADC, SUB, SBC and CP keep their operands for the half-carry flag. The carry out is bit 8
+		// of the 32-bit result, which is set by a borrow too.
+		bool subtract = operation >= 2;
+		bool carry = operation == 1 || operation == 3;
+		emitSetByte(p, m.halfOp, subtract ? m.halfSub : m.halfAdd);
+		emitStoreWord(p, EAX, m.halfX);
+		emitStoreWord(p, ECX, m.halfY);
+		if (carry)
+		{
+			emitLoadByte(p, EDX, m.Cb);
+			emitStoreByte(p, EDX, m.halfCarryIn);
+		}
+		else
+			emitSetByte(p, m.halfCarryIn, 0);
+		*p++ = subtract ? 0x29 : 0x01; *p++ = 0xC8;				// sub or add eax, ecx
+		if (carry)
+		{
+			*p++ = subtract ? 0x29 : 0x01; *p++ = 0xD0;			// sub or add eax, edx
+		}
+		if (operation != 7)
+			emitStoreByte(p, EAX, A);
+		emitStoreByte(p, EAX, m.zeroResult);
+		*p++ = 0xC1; *p++ = 0xE8; *p++ = 0x08;					// shr eax, 8
+		*p++ = 0x83; *p++ = 0xE0; *p++ = 0x01;					// and eax, 1
+		emitStoreByte(p, EAX, m.Cb);
+		emitSetByte(p, m.Nb, subtract);
+	}
+	else
+	{
+		static const uint8_t logicOps[3] = { 0x21, 0x31, 0x09 };
+		*p++ = logicOps[operation - 4]; *p++ = 0xC8;			// and, xor or or eax, ecx
+		emitStoreByte(p, EAX, A);
+		emitStoreByte(p, EAX, m.zeroResult);
+		emitSetByte(p, m.Nb, 0);
+		emitSetByte(p, m.halfOp, m.halfSet);
+		emitSetWord(p, m.halfX, operation == 4);
+		emitSetWord(p, m.halfY, 0);
+		emitSetByte(p, m.halfCarryIn, 0);
+		emitSetByte(p, m.Cb, 0);
+	}
+}
+
+// Compiles an instruction that doesn't jump to native code. Returns false if it has to be left to its
+// handler. mayExit is set if the instruction can set jitExit, by writing memory.
+static bool emitNative(uint8_t*& p, const jitLayout& m, uint8_t op, uint16_t operand, bool& mayExit)
+{
+	const int32_t A = m.registers[7];
+	const int32_t pairs[4] = { m.BC, m.DE, m.HL, m.SP };
+	int dst = (op >> 3) & 0x7;
+	int src = op & 0x7;
+
+	if (op >= 0x40 && op < 0x80 && op != 0x76)	// LD r, r
+	{
+		if (src == 6)
+		{
+			emitLoadWord(p, ECX, m.HL);
+			emitRead(p, m);
+		}
+		else
+			emitLoadByte(p, EAX, m.registers[src]);
+		if (dst == 6)
+		{
+			emitLoadWord(p, ECX, m.HL);
+			emitWrite(p, m);
+			mayExit = true;
+		}
+		else
+			emitStoreByte(p, EAX, m.registers[dst]);
+		return true;
+	}
+	if (op >= 0x80 && op < 0xC0)	// ALU A, r
+	{
+		if (src == 6)
+		{
+			emitLoadWord(p, ECX, m.HL);
+			emitRead(p, m);
+			*p++ = 0x89; *p++ = 0xC1;							// mov ecx, eax
+		}
+		else
+			emitLoadByte(p, ECX, m.registers[src]);
+		emitAlu(p, m, dst);
+		return true;
+	}
+
+	switch (op)
+	{
+	case 0x00:	// NOP
+		return true;
+
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:	// LD r, d8
+		emitSetByte(p, m.registers[dst], operand & 0xFF);
+		return true;
+
+	case 0x36:	// LD (HL), d8
+		*p++ = 0xB8;											// mov eax, d8
+		emitValue(p, operand & 0xFF, 4);
+		emitLoadWord(p, ECX, m.HL);
+		emitWrite(p, m);
+		mayExit = true;
+		return true;
+
+	case 0x01: case 0x11: case 0x21: case 0x31:	// LD rr, d16
+		emitSetWord(p, pairs[op >> 4], operand);
+		return true;
+
+	case 0x03: case 0x13: case 0x23: case 0x33:	// INC rr
+	case 0x0B: case 0x1B: case 0x2B: case 0x3B:	// DEC rr
+		emitStepWord(p, pairs[op >> 4], (op & 0x8) != 0);
+		return true;
+
+	case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C:	// INC r
+	case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D:	// DEC r
+	{
+		bool down = op & 0x1;
+		emitLoadByte(p, EAX, m.registers[dst]);
+		emitSetByte(p, m.halfOp, down ? m.halfSub : m.halfAdd);
+		emitStoreWord(p, EAX, m.halfX);
+		emitSetWord(p, m.halfY, 1);
+		emitSetByte(p, m.halfCarryIn, 0);
+		*p++ = 0x83; *p++ = down ? 0xE8 : 0xC0; *p++ = 0x01;	// sub or add eax, 1
+		emitStoreByte(p, EAX, m.registers[dst]);
+		emitStoreByte(p, EAX, m.zeroResult);
+		emitSetByte(p, m.Nb, down);
+		return true;
+	}
+
+	case 0x02: case 0x12: case 0x22: case 0x32:	// LD (BC), A; LD (DE), A; LD (HL+), A; LD (HL-), A
+		emitLoadByte(p, EAX, A);
+		emitLoadWord(p, ECX, op == 0x02 ? m.BC : op == 0x12 ? m.DE : m.HL);
+		emitWrite(p, m);
+		if (op >= 0x22)
+			emitStepWord(p, m.HL, op == 0x32);
+		mayExit = true;
+		return true;
+
+	case 0x0A: case 0x1A: case 0x2A: case 0x3A:	// LD A, (BC); LD A, (DE); LD A, (HL+); LD A, (HL-)
+		emitLoadWord(p, ECX, op == 0x0A ? m.BC : op == 0x1A ? m.DE : m.HL);
+		emitRead(p, m);
+		emitStoreByte(p, EAX, A);
+		if (op >= 0x2A)
+			emitStepWord(p, m.HL, op == 0x3A);
+		return true;
+
+	case 0xEA:	// LD (a16), A
+		emitLoadByte(p, EAX, A);
+		*p++ = 0xB9;											// mov ecx, a16
+		emitValue(p, operand, 4);
+		emitWrite(p, m);
+		mayExit = true;
+		return true;
+
+	case 0xFA:	// LD A, (a16)
+		*p++ = 0xB9;											// mov ecx, a16
+		emitValue(p, operand, 4);
+		emitRead(p, m);
+		emitStoreByte(p, EAX, A);
+		return true;
+
+	case 0xF9:	// LD SP, HL
+		emitLoadWord(p, EAX, m.HL);
+		emitStoreWord(p, EAX, m.SP);
+		return true;
+
+	case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:	// ALU A, d8
+		*p++ = 0xB9;											// mov ecx, d8
+		emitValue(p, operand & 0xFF, 4);
+		emitAlu(p, m, dst);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Makes part of the code buffer writable, for compiling into it, or executable, for running it. Memory
+// is never both, so a stray write can't turn into code.
+static bool protectJitCode(uint8_t* start, size_t size, bool writable)
+{
+	uint8_t* first = start - reinterpret_cast<uintptr_t>(start) % jitPageSize;
+	size += start - first;
+#ifdef _WIN32
+	DWORD old;
+	return VirtualProtect(first, size, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old) != 0;
+#else
+	return mprotect(first, size, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+// Returns the offset of a member from the start of a gb.
+static int32_t memberOffset(const gb* self, const void* member)
+{
+	return static_cast<int32_t>(static_cast<const uint8_t*>(member) - reinterpret_cast<const uint8_t*>(self));
+}
+#endif
+
+// Runs an instruction's handler. Compiled code calls these plain functions, which take the gb pointer
+// as their only argument, as the layout of a pointer to a member function depends on the compiler.
+template <void (gb::*handler)()>
+void gb::jitThunk(gb* self)
+{
+	(self->*handler)();
+}
+
+#define GB_JIT_THUNK(n) &gb::jitThunk<&gb::op##n>,
+const gb::jitHandler gb::jitThunks[256] = { GB_ALL_OPCODES(GB_JIT_THUNK) };
+#undef GB_JIT_THUNK
+
+// Reads and writes memory without a page pointer, for compiled code.
+uint8_t gb::jitReadIO(gb* self, uint16_t addr)
+{
+	return self->readIO(addr);
+}
+
+void gb::jitWriteIO(gb* self, uint16_t addr, uint8_t data)
+{
+	self->writeIO(addr, data);
+}
+
+// Runs the compiled code for the instruction at PC, compiling a block from there first if it has become
+// hot. Returns the machine cycles taken, or 0 if there is no code to run and the instruction should be
+// interpreted.
+int gb::runJitBlock()
+{
+#ifdef GB_JIT_X64
+	if (!isJitRegion(PC))
+		return 0;
+
+	// Set up the JIT the first time it is used. Without executable memory, stay in the interpreter.
+	if (!jitCode)
+	{
+#ifdef _WIN32
+		jitCode = static_cast<uint8_t*>(VirtualAlloc(nullptr, jitBufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+		void* mem = mmap(nullptr, jitBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		jitCode = mem == MAP_FAILED ? nullptr : static_cast<uint8_t*>(mem);
+#endif
+		if (!jitCode)
+		{
+			backend = INTERPRETER;
+			return 0;
+		}
+		jitBlocks = new jitBlock[0x10000]();
+
+		// Every block is entered through the code at the start of the buffer, which keeps the gb pointer
+		// in rbx, the counter in r12 and nextEventAt in r13, and jumps to the entry point given as the
+		// second argument. Blocks leave through the epilogue after it, which stores the counter. Windows
+		// also needs 32 bytes of shadow space for calls. Both keep the stack 16-byte aligned for calls.
+		const int32_t counterOffset = memberOffset(this, &counter);
+		const int32_t nextEventOffset = memberOffset(this, &nextEventAt);
+		uint8_t* p = jitCode;
+		*p++ = 0x53;											// push rbx
+		*p++ = 0x41; *p++ = 0x54;								// push r12
+		*p++ = 0x41; *p++ = 0x55;								// push r13
+#ifdef _WIN32
+		*p++ = 0x48; *p++ = 0x83; *p++ = 0xEC; *p++ = 0x20;		// sub rsp, 32
+		*p++ = 0x48; *p++ = 0x89; *p++ = 0xCB;					// mov rbx, rcx
+#else
+		*p++ = 0x48; *p++ = 0x89; *p++ = 0xFB;					// mov rbx, rdi
+#endif
+		emitMember(p, 0x4C, 0x8B, 0xA3, counterOffset);			// mov r12, [rbx + counter]
+		emitMember(p, 0x4C, 0x8B, 0xAB, nextEventOffset);		// mov r13, [rbx + nextEventAt]
+#ifdef _WIN32
+		*p++ = 0xFF; *p++ = 0xE2;								// jmp rdx
+#else
+		*p++ = 0xFF; *p++ = 0xE6;								// jmp rsi
+#endif
+		jitEpilogue = p;
+		emitMember(p, 0x4C, 0x89, 0xA3, counterOffset);			// mov [rbx + counter], r12
+#ifdef _WIN32
+		*p++ = 0x48; *p++ = 0x83; *p++ = 0xC4; *p++ = 0x20;		// add rsp, 32
+#endif
+		*p++ = 0x41; *p++ = 0x5D;								// pop r13
+		*p++ = 0x41; *p++ = 0x5C;								// pop r12
+		*p++ = 0x5B;											// pop rbx
+		*p++ = 0xC3;											// ret
+		jitCodeReserved = p - jitCode;
+		jitCodeUsed = jitCodeReserved;
+		if (!protectJitCode(jitCode, jitBufferSize, false))
+		{
+			backend = INTERPRETER;
+			return 0;
+		}
+	}
+
+	// Code in RAM that keeps being written over, as with self-modifying code, has to be reached more
+	// often each time before it is compiled again, so that the time spent compiling stays bounded.
+	jitBlock& block = findJitBlock(PC);
+	if (!block.code)
+	{
+		int threshold = PC >= 0x8000 ? jitThreshold << jitPageRewrites[PC >> 8] : jitThreshold;
+		if (++block.hits < threshold)
+			return 0;
+		if (!compileJitBlock(PC))
+		{
+			block.hits = 0;
+			return 0;
+		}
+	}
+
+	uint64_t start = counter;
+	jitExit = false;
+	reinterpret_cast<void (*)(gb*, const uint8_t*)>(jitCode)(this, block.code);
+	return static_cast<int>(counter - start);
+#else
+	return 0;
+#endif
+}
+
+// Returns the entry for the instruction at an address. Code in ROM is kept by bank, as the same address
+// holds different code after a bank switch, and by window, as compiled code holds the addresses it was
+// compiled at and a bank can be mapped in either window.
+gb::jitBlock& gb::findJitBlock(uint16_t addr)
+{
+	if (addr >= 0x8000)
+		return jitBlocks[addr];
+	int window = addr >> 14;
+	int bank = romWindowBank[window];
+	if (!jitRomBlocks[window][bank])
+		jitRomBlocks[window][bank] = new jitBlock[0x4000]();
+	return jitRomBlocks[window][bank][addr & 0x3FFF];
+}
+
+// Translates the block starting at an address into machine code. Returns false if there is nothing
+// that can be compiled there.
+bool gb::compileJitBlock(uint16_t addr)
+{
+#ifdef GB_JIT_X64
+	if (jitCodeUsed + jitMaxBlockSize > jitBufferSize)
+		flushJit();
+
+	// Only the pages the block can be written to are made writable, and only while it is compiled.
+	uint8_t* start = jitCode + jitCodeUsed;
+	if (!protectJitCode(start, jitMaxBlockSize, true))
+		return false;
+
+	jitLayout m;
+	uint8_t* const registers[8] = { &B, &C, &D, &E, &H, &L, nullptr, &A };
+	for (int i = 0; i < 8; i++)
+		m.registers[i] = registers[i] ? memberOffset(this, registers[i]) : 0;
+	m.BC = memberOffset(this, &BC);
+	m.DE = memberOffset(this, &DE);
+	m.HL = memberOffset(this, &HL);
+	m.SP = memberOffset(this, &SP);
+	m.PC = memberOffset(this, &PC);
+	m.zeroResult = memberOffset(this, &zeroResult);
+	m.Nb = memberOffset(this, &Nb);
+	m.Cb = memberOffset(this, &Cb);
+	m.halfOp = memberOffset(this, &halfOp);
+	m.halfX = memberOffset(this, &halfX);
+	m.halfY = memberOffset(this, &halfY);
+	m.halfCarryIn = memberOffset(this, &halfCarryIn);
+	m.counter = memberOffset(this, &counter);
+	m.nextEventAt = memberOffset(this, &nextEventAt);
+	m.cycles = memberOffset(this, &cycles);
+	m.imm16 = memberOffset(this, &imm16);
+	m.jitExit = memberOffset(this, &jitExit);
+	m.idleLoopValid = memberOffset(this, &idleLoop.valid);
+	m.readPages = memberOffset(this, readPages);
+	m.writePages = memberOffset(this, writePages);
+	m.readIO = reinterpret_cast<uint64_t>(&jitReadIO);
+	m.writeIO = reinterpret_cast<uint64_t>(&jitWriteIO);
+	m.halfAdd = HALF_ADD;
+	m.halfSub = HALF_SUB;
+	m.halfSet = HALF_SET;
+
+	// Jumps that leave the block, and the instruction each leaves at. They all go to code after the
+	// block that sets PC and returns.
+	struct blockExit
+	{
+		uint8_t* jump;
+		uint16_t pc;
+	};
+	blockExit exits[jitMaxInstructions * 3];
+	int exitCount = 0;
+
+	uint8_t* p = start;
+	int count = 0;
+	int pc = addr;
+	bool mayExit = false;	// Set if the last instruction can have set jitExit.
+	bool ended = false;		// Set once the block has jumped or returned.
+
+	// Goes on to the code for an address, which becomes the new PC. If it has already been compiled in
+	// this page, it is jumped to directly unless an event is due. Polling loops are left to the
+	// interpreter each time round, so that skipIdleLoop() can skip them.
+	auto jumpTo = [&](uint16_t target, uint16_t from)
+	{
+		uint16_t reads[4];
+		const uint8_t* code = (target >> 8) == (addr >> 8) && isJitRegion(target) ? findJitBlock(target).code : nullptr;
+		if (code && (target > from || findIdleLoopReads(target, reads) < 0))
+		{
+			*p++ = 0x4D; *p++ = 0x39; *p++ = 0xEC;				// cmp r12, r13
+			exits[exitCount++] = { emitForwardJump(p, 0x0F, 0x83), target };	// jae exit
+			emitJump(p, 0xE9, 0, code);							// jmp code
+		}
+		else
+		{
+			emitSetWord(p, m.PC, target);						// mov word [rbx + PC], target
+			emitJump(p, 0xE9, 0, jitEpilogue);					// jmp epilogue
+		}
+	};
+
+	while (count < jitMaxInstructions)
+	{
+		uint8_t op = readMemory(pc);
+		int end = pc + opLengths[op] - 1;
+		uint16_t operand = readMemory(pc + 2) << 8 | readMemory(pc + 1);
+
+		// Every instruction has to lie in the block's first page, so that a write to that page is enough
+		// to find every block the write could change.
+		if ((end >> 8) != (addr >> 8) || !isJitRegion(end))
+			break;
+
+		// Leave the block if the previous instruction made an event due or asked to stop.
+		if (count > 0)
+		{
+			*p++ = 0x4D; *p++ = 0x39; *p++ = 0xEC;				// cmp r12, r13
+			exits[exitCount++] = { emitForwardJump(p, 0x0F, 0x83), static_cast<uint16_t>(pc) };	// jae exit
+			if (mayExit)
+			{
+				emitMember(p, 0, 0x80, 0xBB, m.jitExit);		// cmp byte [rbx + jitExit], 0
+				*p++ = 0x00;
+				exits[exitCount++] = { emitForwardJump(p, 0x0F, 0x85), static_cast<uint16_t>(pc) };	// jne exit
+			}
+			if (findJitBlock(pc).code)
+			{
+				emitJump(p, 0xE9, 0, findJitBlock(pc).code);	// jmp code
+				ended = true;
+				break;
+			}
+		}
+		findJitBlock(pc).code = p;
+		mayExit = false;
+
+		int next = end + 1;
+		int cycles = opCycles[op];
+		switch (op)
+		{
+		case 0x18:	// JR r8
+		case 0xC3:	// JP a16
+			emitAddCycles(p, cycles);
+			jumpTo(op == 0x18 ? static_cast<uint16_t>(next + static_cast<int8_t>(operand & 0xFF)) : operand, pc);
+			ended = true;
+			break;
+
+		case 0x20: case 0x28: case 0x30: case 0x38:	// JR cc, r8
+		case 0xC2: case 0xCA: case 0xD2: case 0xDA:	// JP cc, a16
+		{
+			// Bit 3 of the opcode picks Z or C being set rather than clear, and bit 4 C rather than Z. The
+			// zero flag is set when zeroResult is 0.
+			bool carryFlag = (op & 0x10) != 0;
+			bool flagSet = (op & 0x08) != 0;
+			emitMember(p, 0, 0x80, 0xBB, carryFlag ? m.Cb : m.zeroResult);	// cmp byte [rbx + flag], 0
+			*p++ = 0x00;
+			bool takenIfZero = carryFlag != flagSet;
+			uint8_t* notTaken = emitForwardJump(p, 0x0F, takenIfZero ? 0x85 : 0x84);	// jne or je notTaken
+			emitAddCycles(p, cycles + 1);
+			jumpTo(op < 0xC0 ? static_cast<uint16_t>(next + static_cast<int8_t>(operand & 0xFF)) : operand, pc);
+			patchJump(notTaken, p);
+			emitAddCycles(p, cycles);
+			jumpTo(static_cast<uint16_t>(next), pc);
+			ended = true;
+			break;
+		}
+
+		default:
+			if (!emitNative(p, m, op, operand, mayExit))
+			{
+				// The operands are fixed for the life of the block. Branches and CB-prefixed instructions
+				// change cycles, so it is set before each call and read back afterwards.
+				emitSetWord(p, m.PC, pc);						// mov word [rbx + PC], pc
+				emitMember(p, 0x4C, 0x89, 0xA3, m.counter);		// mov [rbx + counter], r12
+				emitMember(p, 0, 0xC7, 0x83, m.cycles);			// mov dword [rbx + cycles], opCycles[op]
+				emitValue(p, cycles, 4);
+				if (opLengths[op] > 1)
+					emitSetWord(p, m.imm16, operand);			// mov word [rbx + imm16], operands
+				emitCall(p, reinterpret_cast<uint64_t>(jitThunks[op]));
+				emitMember(p, 0x4C, 0x8B, 0xA3, m.counter);		// mov r12, [rbx + counter]
+				emitMember(p, 0x48, 0x63, 0x83, m.cycles);		// movsxd rax, dword [rbx + cycles]
+				*p++ = 0x49; *p++ = 0x01; *p++ = 0xC4;			// add r12, rax
+				emitMember(p, 0x4C, 0x8B, 0xAB, m.nextEventAt);	// mov r13, [rbx + nextEventAt]
+				mayExit = true;
+
+				// The handler has set PC for anything that ends the block.
+				if (endsBlock(op))
+				{
+					emitJump(p, 0xE9, 0, jitEpilogue);			// jmp epilogue
+					ended = true;
+				}
+			}
+			else
+				emitAddCycles(p, cycles);
+			break;
+		}
+
+		count += 1;
+		pc = next;
+		if (ended)
+			break;
+	}
+
+	if (count > 0)
+	{
+		// A block that stops part way through a run of instructions carries on from the next one in the
+		// interpreter.
+		if (!ended)
+		{
+			emitSetWord(p, m.PC, pc);							// mov word [rbx + PC], pc
+			emitJump(p, 0xE9, 0, jitEpilogue);					// jmp epilogue
+		}
+
+		// Exits to the same instruction share the code that sets PC.
+		uint8_t* stubs[jitMaxInstructions * 3];
+		for (int i = 0; i < exitCount; i++)
+		{
+			int first = 0;
+			while (exits[first].pc != exits[i].pc)
+				first++;
+			if (first == i)
+			{
+				stubs[i] = p;
+				emitSetWord(p, m.PC, exits[i].pc);				// mov word [rbx + PC], pc
+				emitJump(p, 0xE9, 0, jitEpilogue);				// jmp epilogue
+			}
+			patchJump(exits[i].jump, stubs[first]);
+		}
+		jitCodeUsed = p - jitCode;
+	}
+	if (!protectJitCode(start, jitMaxBlockSize, false))
+	{
+		// The block can't be run, so leave everything to the interpreter from now on.
+		backend = INTERPRETER;
+		return false;
+	}
+	if (count == 0)
+		return false;
+
+	// ROM can't be written, so only blocks in RAM need to be found again when memory changes. Writes to
+	// the page, and to its echo in E000-FDFF, are sent through writeIO() to do that.
+	if (addr >= 0x8000)
+		setPageWatch(addr >> 8, WATCH_CODE, true);
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Drops every compiled block starting in a page of RAM after the page has been written to. The code
+// itself stays in the buffer until the next flush, as the block being run may be one of them.
+void gb::invalidateJitPage(uint8_t page)
+{
+	for (int i = 0; i < 0x100; i++)
+	{
+		jitBlocks[(page << 8) | i].code = nullptr;
+		jitBlocks[(page << 8) | i].hits = 0;
+	}
+	if (jitPageRewrites[page] < jitMaxBackoff)
+		jitPageRewrites[page] += 1;
+	setPageWatch(page, WATCH_CODE, false);
+	jitExit = true;
+}
+
+// Throws away every compiled block so that the code buffer can be reused.
+void gb::flushJit()
+{
+	for (int i = 0; i < 0x10000; i++)
+	{
+		jitBlocks[i].code = nullptr;
+		jitBlocks[i].hits = 0;
+	}
+	for (int window = 0; window < 2; window++)
+	{
+		for (int i = 0; i < 512; i++)
+		{
+			delete[] jitRomBlocks[window][i];
+			jitRomBlocks[window][i] = nullptr;
+		}
+	}
+	for (int i = 0; i < 0x100; i++)
+		pageWatches[i] &= ~WATCH_CODE;
+	mapMemory();
+	jitCodeUsed = jitCodeReserved;
+}
+
+// Frees the code buffer and block table.
+void gb::releaseJit()
+{
+#ifdef GB_JIT_X64
+	if (jitCode)
+	{
+#ifdef _WIN32
+		VirtualFree(jitCode, 0, MEM_RELEASE);
+#else
+		munmap(jitCode, jitBufferSize);
+#endif
+	}
+#endif
+	for (int window = 0; window < 2; window++)
+	{
+		for (int i = 0; i < 512; i++)
+		{
+			delete[] jitRomBlocks[window][i];
+			jitRomBlocks[window][i] = nullptr;
+		}
+	}
+	delete[] jitBlocks;
+	jitCode = nullptr;
+	jitBlocks = nullptr;
+}
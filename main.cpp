@@ -1,6 +1,7 @@
 #include "gb.h"
 #include "SDL.h"
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <shobjidl.h>
 #include <string>
@@ -8,58 +9,28 @@
 
 gb myGB; // The Game Boy's CPU is stored as an object.
 
-// Checks to see if the CPU wants to check for dpad/button inputs, then sets the JOYP register depending
-// on what directions/buttons were pressed.
-// Also handles the spacebar to toggle logging.
+// Reads the keyboard and controller and passes the buttons held down to the Game Boy, which works out
+// the JOYP register from them whenever the game reads it.
 void processInputs(const Uint8 kb[], SDL_GameController *controller)
 {
-	// GB wants to check buttons.
-	if (((myGB.memory[JOYP] >> 5) & 0x1) == 0)
-	{
-		if (kb[SDL_SCANCODE_P] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_B))  // A
-			myGB.modifyBit(myGB.memory[JOYP], 0, 0); // If pressing A, set the input state in memory.
-		else
-			myGB.modifyBit(myGB.memory[JOYP], 1, 0); // Else reset the input state (1 = off).
-
-		if (kb[SDL_SCANCODE_O] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_A))  // B
-			myGB.modifyBit(myGB.memory[JOYP], 0, 1);
-		else
-			myGB.modifyBit(myGB.memory[JOYP], 1, 1);
-
-		if (kb[SDL_SCANCODE_L] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_BACK))  // SELECT
-			myGB.modifyBit(myGB.memory[JOYP], 0, 2);
-		else
-			myGB.modifyBit(myGB.memory[JOYP], 1, 2);
-
-		if (kb[SDL_SCANCODE_K] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_START))  // START
-			myGB.modifyBit(myGB.memory[JOYP], 0, 3);
-		else
-			myGB.modifyBit(myGB.memory[JOYP], 1, 3);
-	}
-
-	// GB wants to check D-pad.
-	else if (((myGB.memory[JOYP] >> 4) & 0x1) == 0)
-	{
-		if (kb[SDL_SCANCODE_D] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_RIGHT))  // RIGHT
-			myGB.modifyBit(myGB.memory[JOYP], 0, 0);
-		else
-			myGB.modifyBit(myGB.memory[JOYP], 1, 0);
-
-		if (kb[SDL_SCANCODE_A] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_LEFT))  // LEFT
-			myGB.modifyBit(myGB.memory[JOYP], 0, 1);
-		else
-			myGB.modifyBit(myGB.memory[JOYP], 1, 1);
-
-		if (kb[SDL_SCANCODE_W] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_UP))  // UP
-			myGB.modifyBit(myGB.memory[JOYP], 0, 2);
-		else
-			myGB.modifyBit(myGB.memory[JOYP], 1, 2);
-
-		if (kb[SDL_SCANCODE_S] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_DOWN))  // DOWN
-			myGB.modifyBit(myGB.memory[JOYP], 0, 3);
-		else
-			myGB.modifyBit(myGB.memory[JOYP], 1, 3);
-	}
+	uint8_t pressed = 0;
+	if (kb[SDL_SCANCODE_P] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_B))
+		pressed |= gb::JOYPAD_A;
+	if (kb[SDL_SCANCODE_O] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_A))
+		pressed |= gb::JOYPAD_B;
+	if (kb[SDL_SCANCODE_L] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_BACK))
+		pressed |= gb::JOYPAD_SELECT;
+	if (kb[SDL_SCANCODE_K] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_START))
+		pressed |= gb::JOYPAD_START;
+	if (kb[SDL_SCANCODE_D] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_RIGHT))
+		pressed |= gb::JOYPAD_RIGHT;
+	if (kb[SDL_SCANCODE_A] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_LEFT))
+		pressed |= gb::JOYPAD_LEFT;
+	if (kb[SDL_SCANCODE_W] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_UP))
+		pressed |= gb::JOYPAD_UP;
+	if (kb[SDL_SCANCODE_S] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_DOWN))
+		pressed |= gb::JOYPAD_DOWN;
+	myGB.setJoypad(pressed);
 }
 
 // Draw a pixel of an 8x8 tile.
@@ -308,6 +279,12 @@ int main(int argc, char* args[])
 		}
 	}
 	
+	// Pick the CPU backend: -cached runs ROM from pre-decoded instructions, -jit also compiles hot code.
+	if (argc > 1 && strcmp(args[1], "-cached") == 0)
+		myGB.backend = gb::CACHED;
+	else if (argc > 1 && strcmp(args[1], "-jit") == 0)
+		myGB.backend = gb::JIT;
+
 	myGB.initialize();  // Set up the Game Boy.
 
 	// Open the file dialog and let the user select the ROM they want to play, and store its path.
@@ -322,31 +299,26 @@ int main(int argc, char* args[])
 
 	uint32_t gfxArray[160 * 144];  // Stores the RGB value of each pixel.
 	
-	int cyclesSinceLastUpdate = 0;  // Every 100 cycles of the CPU, update the keyboard state.
-	myGB.modifyBit(myGB.memory[LCDC], 1, 7);
-
-	// Keep emulating until the end of time itself.
+	// Keep emulating until the end of time itself. The core runs the PPU itself and stops when a line is
+	// ready to be drawn or a whole frame can be shown. Input is read once a frame, or once a frame's
+	// worth of cycles while the LCD is off.
 	for (;;)
 	{
-		// A scanline is drawn every 456 cycles, so run CPU for 456 cycles.
-		for (int i = 0; i < 456; i++)
+		gb::stopReason reason = myGB.runUntil(gb::STOP_LINE | gb::STOP_FRAME, 17556);
+		if (reason != gb::STOP_LINE)
 		{
-			myGB.emulateCycle();
-			cyclesSinceLastUpdate += 1;
-
-			// Update input state every 100 cycles to prevent slowdown.
-			if (cyclesSinceLastUpdate == 100)
-			{
-				// Update the event queue and controller state.
-				SDL_PumpEvents();
-				SDL_GameControllerUpdate();
-				cyclesSinceLastUpdate = 0;
-			}
+			// Update the event queue and controller state.
+			SDL_PumpEvents();
+			SDL_GameControllerUpdate();
 			processInputs(kb, controller);
+
+			// Stop once the window is closed. Destroying myGB writes back the save file.
+			if (SDL_QuitRequested())
+				break;
 		}
-		
-		// If not in VBLANK, draw to the screen.
-		if (myGB.memory[LY] < 0x90)
+
+		// The PPU has reached HBLANK on a visible line, so draw that line.
+		if (reason == gb::STOP_LINE)
 		{
 			drawBackground(gfxArray);
 
@@ -355,48 +327,14 @@ int main(int argc, char* args[])
 				drawWindow(gfxArray);
 			if ((myGB.memory[LCDC] >> 1) & 0x1)
 				drawSprites(gfxArray);
-
 		}
-	
-		myGB.memory[LY] += 1; // Increment LY as a scanline has been drawn.
 
-		if (myGB.memory[LY] == myGB.memory[LYC])
-		{
-			if ((myGB.memory[STAT] >> 6) & 0x1)
-				myGB.modifyBit(myGB.memory[IF], 1, 1);	// STAT interrupt.
-		}
-			
-		// Now in HBLANK.
-		myGB.modifyBit(myGB.memory[STAT], 0, 0);
-		myGB.modifyBit(myGB.memory[STAT], 0, 1);
-		if ((myGB.memory[STAT] >> 3) & 0x1)
-			myGB.modifyBit(myGB.memory[IF], 1, 1);	// STAT interrupt.
-		
-		// Once all scanlines have been drawn, render to the screen and set the V-Blank interrupt.
-		if (myGB.memory[LY] == 0x90)
+		// Once all scanlines have been drawn, render to the screen.
+		if (reason == gb::STOP_FRAME)
 		{
 			SDL_UpdateTexture(texture, NULL, gfxArray, 160 * 4);
 			SDL_RenderCopy(renderer, texture, NULL, NULL);
 			SDL_RenderPresent(renderer);
-			myGB.modifyBit(myGB.memory[IF], 1, 0);	// VBLANK interrupt.
-
-			// Set mode flag in STAT for VBLANK.
-			myGB.modifyBit(myGB.memory[STAT], 1, 0);
-			myGB.modifyBit(myGB.memory[STAT], 0, 1);
-			if ((myGB.memory[STAT] >> 4) & 0x1)
-				myGB.modifyBit(myGB.memory[IF], 1, 1);	// STAT interrupt.
-		}
-			
-		// If LY exceeds its maximum value, reset it (end of V-Blank period).
-		if (myGB.memory[LY] > 0x99)
-		{
-			myGB.memory[LY] = 0x00;  // Reset LY.
-
-			// Set mode flag in STAT for HBLANK.
-			myGB.modifyBit(myGB.memory[STAT], 0, 0);
-			myGB.modifyBit(myGB.memory[STAT], 0, 1);
-			if ((myGB.memory[STAT] >> 3) & 0x1)
-				myGB.modifyBit(myGB.memory[IF], 1, 1);	// STAT interrupt.
 		}
 	}
 }
\ No newline at end of file
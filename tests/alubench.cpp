@@ -0,0 +1,216 @@
+// Times the branch-free ALU arithmetic and DAA table in alu.h against copies of the helpers they
+// replaced, which picked the carry and half-carry paths with branches and adjusted DAA with a tree of
+// them. Both run ADD, ADC, SUB, SBC, CP and DAA on the same stream of random operands, after checking
+// that they give the same A and flags for all of it. Returns 0 if they agree.
+#include "../alu.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// A, and the flags as separate bits, as the old helpers kept them.
+struct aluState
+{
+	uint8_t A, Zb, Nb, Hb, Cb;
+};
+
+enum aluOp { OP_ADD, OP_ADC, OP_SUB, OP_SBC, OP_CP, OP_DAA, OP_COUNT };
+
+struct aluInput
+{
+	uint8_t op, value;
+};
+
+// The old helpers, as they were before the tables.
+static bool oldCheckZero(uint8_t val)
+{
+	if (val == 0)
+		return 1;
+	else
+		return 0;
+}
+
+static bool oldCheckHalfCarry(aluState& s, uint8_t a, uint8_t b, char mode)
+{
+	if (mode == '+')
+		if (((a & 0xF) + (b & 0xF)) > 0xF)
+			return 1;
+		else
+			return 0;
+	else if (mode == '-')
+		if ((a & 0xF) < (b & 0xF))
+			return 1;
+		else
+			return 0;
+	return s.Hb;
+}
+
+static void oldADD(aluState& s, uint8_t val2, bool carry)
+{
+	if (carry)
+	{
+		uint8_t newCb = (s.A > (0xFF - val2 - s.Cb));
+		s.Hb = (((s.A & 0xF) + (val2 & 0xF) + s.Cb) > 0xF);
+		s.A += val2 + s.Cb;
+		s.Cb = newCb;
+	}
+	else
+	{
+		s.Cb = s.A > (0xFF - val2);
+		s.Hb = oldCheckHalfCarry(s, s.A, val2, '+');
+		s.A += val2;
+	}
+	s.Zb = oldCheckZero(s.A);
+	s.Nb = 0;
+}
+
+static void oldSUB(aluState& s, uint8_t val, bool carry)
+{
+	if (carry)
+	{
+		uint8_t newCb = (val + s.Cb > s.A);
+		s.Hb = (((s.A & 0xF) < (val & 0xF) + s.Cb));
+		s.A = s.A - val - s.Cb;
+		s.Cb = newCb;
+	}
+	else
+	{
+		s.Cb = val > s.A;
+		s.Hb = oldCheckHalfCarry(s, s.A, val, '-');
+		s.A -= val;
+	}
+	s.Zb = oldCheckZero(s.A);
+	s.Nb = 1;
+}
+
+static void oldCP(aluState& s, uint8_t val)
+{
+	s.Cb = val > s.A;
+	s.Hb = oldCheckHalfCarry(s, s.A, val, '-');
+	s.Zb = oldCheckZero(s.A - val);
+	s.Nb = 1;
+}
+
+static void oldDAA(aluState& s)
+{
+	if (s.Nb == 0)
+	{
+		if (s.A > 0x99 || s.Cb == 1)
+		{
+			s.A += 0x60;
+			s.Cb = 1;
+		}
+		if (((s.A & 0xF) > 0x9) || s.Hb == 1)
+			s.A += 0x6;
+	}
+	else
+	{
+		if (s.Cb == 1)
+		{
+			s.A -= 0x60;
+			s.Cb = 1;
+		}
+		if (s.Hb == 1)
+			s.A -= 0x6;
+	}
+	s.Zb = oldCheckZero(s.A);
+	s.Hb = 0;
+}
+
+static void runOld(aluState& s, const aluInput& in)
+{
+	switch (in.op)
+	{
+	case OP_ADD: oldADD(s, in.value, false); break;
+	case OP_ADC: oldADD(s, in.value, true); break;
+	case OP_SUB: oldSUB(s, in.value, false); break;
+	case OP_SBC: oldSUB(s, in.value, true); break;
+	case OP_CP: oldCP(s, in.value); break;
+	default: oldDAA(s); break;
+	}
+}
+
+// The same instructions through alu.h, as gb.cpp does them, but with H worked out straight away.
+static void runTables(aluState& s, const aluInput& in)
+{
+	uint8_t carryIn = (in.op == OP_ADC || in.op == OP_SBC) & s.Cb;
+	switch (in.op)
+	{
+	case OP_ADD:
+	case OP_ADC:
+	{
+		uint16_t sum = addBytes(s.A, in.value, carryIn);
+		s.Hb = halfCarryAdd(s.A, in.value, carryIn);
+		s.A = sum & 0xFF;
+		s.Cb = sum >> 8;
+		s.Zb = s.A == 0;
+		s.Nb = 0;
+		break;
+	}
+	case OP_SUB:
+	case OP_SBC:
+	case OP_CP:
+	{
+		uint16_t diff = subBytes(s.A, in.value, carryIn);
+		s.Hb = halfCarrySub(s.A, in.value, carryIn);
+		if (in.op != OP_CP)
+			s.A = diff & 0xFF;
+		s.Cb = diff >> 8;
+		s.Zb = (diff & 0xFF) == 0;
+		s.Nb = 1;
+		break;
+	}
+	default:
+	{
+		uint16_t result = daaResult(s.A, s.Nb, s.Hb, s.Cb);
+		s.A = result & 0xFF;
+		s.Cb = result >> 8;
+		s.Zb = s.A == 0;
+		s.Hb = 0;
+		break;
+	}
+	}
+}
+
+// Runs a stream of instructions a number of times, returning the nanoseconds taken per instruction.
+template <void (*run)(aluState&, const aluInput&)>
+static double timeStream(const std::vector<aluInput>& stream, int repeats, aluState& s)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++)
+	{
+		for (const aluInput& in : stream)
+			run(s, in);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return seconds / (static_cast<double>(stream.size()) * repeats) * 1e9;
+}
+
+int main()
+{
+	std::mt19937 random(1);
+	std::vector<aluInput> stream(4096);
+	for (aluInput& in : stream)
+		in = { static_cast<uint8_t>(random() % OP_COUNT), static_cast<uint8_t>(random()) };
+
+	aluState oldState = {}, newState = {};
+	long mismatches = 0;
+	for (const aluInput& in : stream)
+	{
+		runOld(oldState, in);
+		runTables(newState, in);
+		if (oldState.A != newState.A || oldState.Zb != newState.Zb || oldState.Nb != newState.Nb ||
+			oldState.Hb != newState.Hb || oldState.Cb != newState.Cb)
+		{
+			mismatches++;
+			newState = oldState;
+		}
+	}
+
+	const int repeats = 50000;
+	double oldTime = timeStream<runOld>(stream, repeats, oldState);
+	double newTime = timeStream<runTables>(stream, repeats, newState);
+	printf("alubench: old helpers %.2f ns, tables %.2f ns per instruction (%.2fx), %ld mismatches, A %02X %02X\n",
+		oldTime, newTime, oldTime / newTime, mismatches, oldState.A, newState.A);
+	return mismatches ? 1 : 0;
+}
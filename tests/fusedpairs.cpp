@@ -0,0 +1,47 @@
+// Checks that the cached interpreter's fused instruction pairs do their I/O at the same cycle as the
+// interpreter. Returns 0 if it passes.
+#include "testrom.h"
+
+static gb interpreter, cached;
+
+int main()
+{
+	testRom rom;
+
+	// Resets DIV through the fused LD A, (HL+); LD (DE), A, then reads DIV into a page of WRAM every 9
+	// cycles, which lands on every cycle of DIV's 64-cycle period. Repeats for C000-DFFF.
+	const uint8_t code[] =
+	{
+		0x31, 0xF0, 0xDF,			// LD SP, DFF0
+		0x11, 0x04, 0xFF,			// LD DE, FF04
+		0x21, 0x00, 0x00,			// LD HL, 0000
+		0x01, 0x00, 0xC0,			// LD BC, C000
+		0x2A,						// LD A, (HL+)
+		0x12,						// LD (DE), A
+		0xF0, 0x04,					// LDH A, (04)
+		0x02,						// LD (BC), A
+		0x0C,						// INC C
+		0x20, 0xFA,					// JR NZ, -6
+		0x04,						// INC B
+		0x78,						// LD A, B
+		0xFE, 0xE0,					// CP E0
+		0x20, 0xF2,					// JR NZ, -14
+		0x18, 0xFE,					// JR -2
+	};
+	rom.put(0x150, code, sizeof(code));
+
+	rom.load(interpreter, "fusedpairs");
+	rom.load(cached, "fusedpairs");
+	cached.backend = gb::CACHED;
+	interpreter.runCycles(100000);
+	cached.runCycles(100000);
+
+	int failures = 0;
+	for (int addr = 0xC000; addr < 0xE000; addr++)
+	{
+		if (cached.memory[addr] != interpreter.memory[addr] && failures++ < 10)
+			printf("%04X is %02X, expected %02X.\n", addr, cached.memory[addr], interpreter.memory[addr]);
+	}
+	printf(failures ? "fusedpairs: FAILED\n" : "fusedpairs: passed\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+// Checks that code compiled for a ROM bank in one window isn't run when the same bank is mapped in the
+// other. MBC5 maps bank 0 at 4000-7FFF when 0 is written to 2000. Returns 0 if it passes.
+#include "testrom.h"
+
+static gb g;
+
+int main()
+{
+	testRom rom(0x19);
+
+	// Calls a routine at 0300 until it has been compiled, then maps bank 0 at 4000 and calls the same
+	// routine at 4300. The routine stores the address its call returns to at DE.
+	const uint8_t code[] =
+	{
+		0x31, 0xF0, 0xDF,			// LD SP, DFF0
+		0x11, 0x00, 0xC0,			// LD DE, C000
+		0x06, 0x40,					// LD B, 40
+		0xCD, 0x00, 0x03,			// CALL 0300
+		0x05,						// DEC B
+		0x20, 0xFA,					// JR NZ, -6
+		0xAF,						// XOR A
+		0xEA, 0x00, 0x20,			// LD (2000), A
+		0x06, 0x40,					// LD B, 40
+		0xCD, 0x00, 0x43,			// CALL 4300
+		0x05,						// DEC B
+		0x20, 0xFA,					// JR NZ, -6
+		0x18, 0xFE,					// JR -2
+	};
+	rom.put(0x150, code, sizeof(code));
+	const uint8_t routine[] =
+	{
+		0xCD, 0x10, 0x03,			// CALL 0310
+		0xC9,						// RET
+	};
+	rom.put(0x300, routine, sizeof(routine));
+	const uint8_t store[] =
+	{
+		0xE1,						// POP HL
+		0xE5,						// PUSH HL
+		0x7C,						// LD A, H
+		0x12,						// LD (DE), A
+		0x13,						// INC DE
+		0x7D,						// LD A, L
+		0x12,						// LD (DE), A
+		0x13,						// INC DE
+		0xC9,						// RET
+	};
+	rom.put(0x310, store, sizeof(store));
+
+	rom.load(g, "jitbanks");
+	g.backend = gb::JIT;
+	g.runCycles(100000);
+
+	int failures = 0;
+	for (int call = 0; call < 0x80; call++)
+	{
+		int expected = call < 0x40 ? 0x0303 : 0x4303;
+		int stored = g.memory[0xC000 + call * 2] << 8 | g.memory[0xC001 + call * 2];
+		if (stored != expected && failures++ < 10)
+			printf("Call %d returned to %04X, expected %04X.\n", call, stored, expected);
+	}
+	printf(failures ? "jitbanks: FAILED\n" : "jitbanks: passed\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+// Checks that every RAM bank of a 128KB MBC5 cartridge keeps what is written to it. Returns 0 if it
+// passes.
+#include "testrom.h"
+
+static gb g;
+
+int main()
+{
+	// MBC5 with 128KB of RAM and no battery, so that no .sav file is made.
+	testRom rom(0x1A, 0x04);
+
+	// Writes each bank's number XOR 5A to the start of the bank, then reads the 16 banks back into C000.
+	const uint8_t code[] =
+	{
+		0x31, 0xF0, 0xDF,			// LD SP, DFF0
+		0x3E, 0x0A,					// LD A, 0A
+		0xEA, 0x00, 0x00,			// LD (0000), A
+		0x06, 0x00,					// LD B, 0
+		0x78,						// LD A, B
+		0xEA, 0x00, 0x40,			// LD (4000), A
+		0xEE, 0x5A,					// XOR 5A
+		0xEA, 0x00, 0xA0,			// LD (A000), A
+		0x04,						// INC B
+		0x78,						// LD A, B
+		0xFE, 0x10,					// CP 10
+		0x20, 0xF1,					// JR NZ, -15
+		0x06, 0x00,					// LD B, 0
+		0x21, 0x00, 0xC0,			// LD HL, C000
+		0x78,						// LD A, B
+		0xEA, 0x00, 0x40,			// LD (4000), A
+		0xFA, 0x00, 0xA0,			// LD A, (A000)
+		0x22,						// LD (HL+), A
+		0x04,						// INC B
+		0x78,						// LD A, B
+		0xFE, 0x10,					// CP 10
+		0x20, 0xF2,					// JR NZ, -14
+		0x18, 0xFE,					// JR -2
+	};
+	rom.put(0x150, code, sizeof(code));
+
+	rom.load(g, "mbcram");
+	g.runCycles(10000);
+
+	int failures = 0;
+	for (int bank = 0; bank < 16; bank++)
+	{
+		if (g.memory[0xC000 + bank] != (bank ^ 0x5A))
+		{
+			printf("RAM bank %d read back %02X, expected %02X.\n", bank, g.memory[0xC000 + bank], bank ^ 0x5A);
+			failures++;
+		}
+	}
+	printf(failures ? "mbcram: FAILED\n" : "mbcram: passed\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,57 @@
+// Times the interpreter on a loop of common instructions: loads and stores through HL, ALU ops,
+// CB-prefixed ops, CALL, RET and JP. Built once with GB_THREADED defined and once without, and prints
+// millions of instructions per second for the build's dispatch.
+#include "testrom.h"
+#include <chrono>
+
+static gb g;
+
+int main()
+{
+	testRom rom;
+
+	// Each time round the loop runs 14 instructions in 31 machine cycles.
+	const int loopInstructions = 14;
+	const int loopCycles = 31;
+	const uint8_t code[] =
+	{
+		0x31, 0xF0, 0xDF,			// LD SP, DFF0
+		0x21, 0x00, 0xC0,			// LD HL, C000
+		0x01, 0x00, 0x00,			// LD BC, 0000
+		0x7E,						// LD A, (HL)
+		0x81,						// ADD A, C
+		0x22,						// LD (HL+), A
+		0x57,						// LD D, A
+		0xCB, 0x32,					// SWAP D
+		0xAA,						// XOR D
+		0x03,						// INC BC
+		0x7D,						// LD A, L
+		0xE6, 0x3F,					// AND 3F
+		0x6F,						// LD L, A
+		0xCD, 0x80, 0x01,			// CALL 0180
+		0xC3, 0x59, 0x01,			// JP 0159
+	};
+	rom.put(0x150, code, sizeof(code));
+	const uint8_t function[] =
+	{
+		0xCB, 0x7F,					// BIT 7, A
+		0xC9,						// RET
+	};
+	rom.put(0x180, function, sizeof(function));
+
+	rom.load(g, "mipsbench");
+	g.idleLoopSkipping = false;
+
+	const uint64_t cycles = 200000000;
+	auto start = std::chrono::steady_clock::now();
+	g.runCycles(cycles);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double instructions = static_cast<double>(cycles) * loopInstructions / loopCycles;
+#ifdef GB_THREADED
+	const char* dispatch = "threaded";
+#else
+	const char* dispatch = "table";
+#endif
+	printf("mipsbench: %s dispatch, %.1f MIPS\n", dispatch, instructions / seconds / 1e6);
+	return 0;
+}
@@ -0,0 +1,51 @@
+// Checks that two instances running the same battery-backed game don't share cartridge RAM through its
+// .sav file. Only the first to load the game maps the save; the second gets a copy. Returns 0 if it
+// passes.
+#include "testrom.h"
+
+static gb first, second;
+
+int main()
+{
+	// MBC5 with 8KB of RAM and a battery.
+	testRom rom(0x1B, 0x02);
+	remove("savealias.sav");
+
+	// Adds one to the byte at A000 and copies it to C000.
+	const uint8_t code[] =
+	{
+		0x3E, 0x0A,					// LD A, 0A
+		0xEA, 0x00, 0x00,			// LD (0000), A
+		0xFA, 0x00, 0xA0,			// LD A, (A000)
+		0x3C,						// INC A
+		0xEA, 0x00, 0xA0,			// LD (A000), A
+		0xEA, 0x00, 0xC0,			// LD (C000), A
+		0x18, 0xFE,					// JR -2
+	};
+	rom.put(0x150, code, sizeof(code));
+
+	// Both load the game before either runs, so each should count from the empty save.
+	rom.load(first, "savealias");
+	rom.load(second, "savealias");
+	first.runCycles(1000);
+	second.runCycles(1000);
+
+	first.flushSave(true);
+	uint8_t saved = 0;
+	std::ifstream("savealias.sav", std::ios::binary).read(reinterpret_cast<char*>(&saved), 1);
+
+	int failures = 0;
+	if (first.memory[0xC000] != 1 || second.memory[0xC000] != 1)
+	{
+		printf("The instances counted to %d and %d, expected 1 and 1.\n", first.memory[0xC000], second.memory[0xC000]);
+		failures++;
+	}
+	if (saved != 1)
+	{
+		printf("The save file holds %d, expected 1.\n", saved);
+		failures++;
+	}
+	remove("savealias.sav");
+	printf(failures ? "savealias: FAILED\n" : "savealias: passed\n");
+	return failures ? 1 : 0;
+}
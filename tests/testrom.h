@@ -0,0 +1,43 @@
+// A cartridge for the tests and benchmarks to run their own code on. They are built by CMakeLists.txt
+// at the top of the repository, and run from the build directory, as the ROM is written to a file there
+// for loadGame().
+#ifndef TESTROM_H
+#define TESTROM_H
+#include "../gb.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+// A 32KB ROM that jumps from the entry point to code at 0150, with everything else zero. type and
+// ramSize go in the header at 0147 and 0149.
+struct testRom
+{
+	uint8_t data[0x8000] = {};
+
+	testRom(uint8_t type = 0x00, uint8_t ramSize = 0x00)
+	{
+		const uint8_t entry[] = { 0x00, 0xC3, 0x50, 0x01 };					// NOP; JP 0150
+		memcpy(data + 0x100, entry, sizeof(entry));
+		data[0x147] = type;
+		data[0x149] = ramSize;
+	}
+
+	// Copies code into the ROM at an address.
+	void put(uint16_t addr, const uint8_t* code, size_t size)
+	{
+		memcpy(data + addr, code, size);
+	}
+
+	// Starts an instance on the ROM. The file is deleted again once it is loaded.
+	void load(gb& g, const char* name)
+	{
+		char filename[64];
+		snprintf(filename, sizeof(filename), "%s.gb", name);
+		std::ofstream(filename, std::ios::binary).write(reinterpret_cast<const char*>(data), sizeof(data));
+		char title[17];
+		g.initialize();
+		g.loadGame(filename, title);
+		remove(filename);
+	}
+};
+#endif